@@ -7,9 +7,12 @@
 #include <sys/wait.h> // waitpid()
 #include <sys/stat.h>
 #include <fcntl.h> // open(), creat(), close()
-#include <time.h>
 #include <errno.h>
+#include <signal.h> // signal()
 #include "ai_handler.h"
+#include "prompt.h"
+#include "script.h"
+#include "on_change.h"
 // ######################################################################################
 
 // ############################## DEFINE SECTION ########################################
@@ -20,9 +23,6 @@
 #define MAX_HISTORY_SIZE 128
 #define MAX_COMMAND_NAME_LENGTH 128
 
-#define PROMPT_FORMAT "%F %T "
-#define PROMPT_MAX_LENGTH 30
-
 #define TOFILE_DIRECT ">"
 #define APPEND_TOFILE_DIRECT ">>"
 #define FROMFILE "<"
@@ -56,57 +56,6 @@ void init_shell(void) {
     printf("\n");
 }
 
-char *get_current_dir(void) {
-    char cwd[FILENAME_MAX];
-    char*result = getcwd(cwd, sizeof(cwd));
-    return result;
-}
-
-/**
- * Hàm khởi tạo Shell Prompt có dạng YYYY-MM-dd <space> hour:minute:second <space> default name of shell <space> >
- * @param None
- * @return a prompt string
- */
-char *prompt(void) {
-    static char *_prompt = NULL;
-    time_t now;
-    struct tm *tmp;
-    size_t size;
-
-    if (_prompt == NULL) {
-        _prompt = malloc(PROMPT_MAX_LENGTH * sizeof(char));
-        if (_prompt == NULL) {
-            perror("Error: Unable to locate memory");
-            exit(EXIT_FAILURE);
-        }
-    }
-
-    // Lấy ngày tháng năm
-    now = time(NULL);
-    if (now == -1) {
-        fprintf(stderr, "Error: Cannot get current timestamp");
-        exit(EXIT_FAILURE);
-    }
-
-    // Lấy giờ hệ thống
-    tmp = localtime(&now);
-    if (tmp == NULL) {
-        fprintf(stderr, "Error: Cannot identify timestamp");
-        exit(EXIT_FAILURE);
-    }
-
-    // Tạo chuỗi theo format YYYY-MM-dd <space> hour:minute:second <space>
-    size = strftime(_prompt, PROMPT_MAX_LENGTH, PROMPT_FORMAT, tmp);
-    if (size == 0) {
-        fprintf(stderr, "Error: Cannot convert time to string");
-        exit(EXIT_FAILURE);
-    }
-    // Thêm vào sau tên mặc định của shell
-    char* username = getenv("USER");
-    strncat(_prompt, username, strlen(username));
-    return _prompt;
-}
-
 /**
  * Hàm báo lỗi
  * @param None
@@ -407,20 +356,25 @@ char *get_prev_command(char *history) {
 int simple_shell_cd(char **args);
 int simple_shell_help(char **args);
 int simple_shell_exit(char **args);
-void exec_command(char **args, char **redir_argv, int wait, int res);
+int simple_shell_on_change(char **args);
+int exec_command(char **args, char **redir_argv, int wait, int res);
+int dispatch_in_shell(char **args, int *status);
+pid_t launch_command(char **args);
 
 // List of builtin commands
 char *builtin_str[] = {
     "cd",
     "help",
-    "exit"
+    "exit",
+    "on-change"
 };
 
 // Corresponding functions.
 int (*builtin_func[])(char **) = {
     &simple_shell_cd,
     &simple_shell_help,
-    &simple_shell_exit
+    &simple_shell_exit,
+    &simple_shell_on_change
 };
 
 int simple_shell_num_builtins(void) {
@@ -432,18 +386,20 @@ int simple_shell_num_builtins(void) {
 /**
  * @description Hàm cd (change directory) bằng cách gọi hàm chdir()
  * @param argv mảng chuỗi chứa những chuỗi arg để thực hiện lệnh
- * @return 0 nếu thất bại, 1 nếu thành công
+ * @return 0 nếu thành công, 1 nếu thất bại
  */
 int simple_shell_cd(char **argv) {
     if (argv[1] == NULL) {
         fprintf(stderr, "Error: Expected argument to \"cd\"\n");
-    } else {
-        // Change the process's working directory to PATH.
-        if (chdir(argv[1]) != 0) {
-            perror("Error: Error when change the process's working directory to PATH.");
-        }
+        return 1;
+    }
+    // Change the process's working directory to PATH.
+    if (chdir(argv[1]) != 0) {
+        perror("Error: Error when change the process's working directory to PATH.");
+        return 1;
     }
-    return 1;
+    prompt_cwd_changed();
+    return 0;
 }
 
 /**
@@ -464,7 +420,8 @@ int simple_shell_help(char **argv) {
         "Usage help command. Type help [command name] for help/more information.\n"
         "Options for [command name]:\n"
         "cd <directory name>\t\t\tDescription: Change the current working directory.\n"
-        "exit              \t\t\tDescription: Exit Ayuub & Clinton's shell, returning to the Linux shell.\n";
+        "exit              \t\t\tDescription: Exit Ayuub & Clinton's shell, returning to the Linux shell.\n"
+        "on-change [-d ms] <paths...> -- <command>\tDescription: Rerun command whenever the paths change (Ctrl-C to stop).\n";
     static char help_cd_command[] = "HELP CD COMMAND\n";
     static char help_exit_command[] = "HELP EXIT COMMAND\n";
 
@@ -496,10 +453,19 @@ int simple_shell_help(char **argv) {
     return 0;    // Return an int, matching the function pointer type
 }
 
+/**
+ * @description Hàm on-change: chạy lại lệnh mỗi khi file trong các path thay đổi (inotify)
+ * @param args mảng chuỗi chứa những chuỗi arg để thực hiện lệnh
+ * @return 0 nếu thành công, 1 nếu lỗi
+ */
+int simple_shell_on_change(char **args) {
+    return on_change_command(args, launch_command);
+}
+
 
 /**
- * @description Hàm thoát
- * @param 
+ * @description Hàm chạy lại lệnh trước đó (!!)
+ * @param history chuỗi history, redir_args mảng chuỗi cho chuyển hướng IO
  * @return
  */
 int simple_shell_history(char *history, char **redir_args) {
@@ -513,6 +479,11 @@ int simple_shell_history(char *history, char **redir_args) {
     }
     strcpy(cur_command, history);
     printf("%s\n", cur_command);
+    // Blocks, functions and $-expansion go back through the scripting layer, like in main()
+    if (script_wants_line(cur_command)) {
+        prompt_set_status(script_eval(cur_command, NULL, NULL, 0));
+        return 0;
+    }
     parse_command(cur_command, cur_args, &t_wait);
     int res = 0;
     exec_command(cur_args, redir_args, t_wait, res);
@@ -563,20 +534,61 @@ int simple_shell_pipe(char **args) {
 }
 
 /**
- * @description Hàm thực thi lệnh
- * @param 
- * @return
+ * @description Phần chạy trong tiến trình con của exec_command: chuyển hướng IO, pipe hoặc execvp
+ * @param args mảng chuỗi chứa những chuỗi arg để thực hiện lệnh, redir_argv mảng chuỗi cho chuyển hướng IO
+ * @return không trả về
  */
-void exec_command(char **args, char **redir_argv, int wait, int res) {
-    // Kiểm tra có trùng với lệnh nào trong mảng builtin command không, có thì thực thi, không thì xuống tiếp dưới
+void exec_child_command(char **args, char **redir_argv) {
+    int res = 0;
+    if (res == 0) res = simple_shell_redirect(args, redir_argv);
+    if (res == 0) res = simple_shell_pipe(args);
+    if (res == 0 && execvp(args[0], args) < 0) exit(127);
+    exit(EXIT_SUCCESS);
+}
+
+/**
+ * @description Tìm builtin command theo tên
+ * @param name tên lệnh
+ * @return index trong builtin_str, -1 nếu không phải builtin
+ */
+int find_builtin(const char *name) {
     for (int i = 0; i < simple_shell_num_builtins(); i++) {
-        if (strcmp(args[0], builtin_str[i]) == 0) {
-            (*builtin_func[i])(args);
-            res = 1;
+        if (strcmp(name, builtin_str[i]) == 0) {
+            return i;
         }
     }
+    return -1;
+}
+
+/**
+ * @description Chạy lệnh ngay trong shell theo đúng thứ tự của dòng lệnh tương tác: builtin, rồi
+ * hàm người dùng / source của scripting layer. Hàm có redirect hoặc pipe vẫn đi qua fork/exec.
+ * @param args mảng chuỗi chứa những chuỗi arg để thực hiện lệnh, status nhận exit status
+ * @return 1 nếu đã chạy, 0 nếu cần fork/exec
+ */
+int dispatch_in_shell(char **args, int *status) {
+    int i = find_builtin(args[0]);
+    if (i >= 0) {
+        *status = (*builtin_func[i])(args);
+        return 1;
+    }
+    return is_redirect(args) < 0 && is_pipe(args) < 0 && script_call(args, status);
+}
+
+/**
+ * @description Hàm thực thi lệnh
+ * @param 
+ * @return exit status của lệnh (0 nếu chạy nền)
+ */
+int exec_command(char **args, char **redir_argv, int wait, int res) {
+    int exit_status = 0;
+
+    // Builtin command, hàm hoặc source thì thực thi luôn, không thì xuống tiếp dưới
+    if (dispatch_in_shell(args, &exit_status)) {
+        res = 1;
+    }
 
-    // Chưa thực thi builtin commands
+    // Chưa thực thi
     if (res == 0) {
         int status;
 
@@ -584,10 +596,7 @@ void exec_command(char **args, char **redir_argv, int wait, int res) {
         pid_t pid = fork();
         if (pid == 0) {
             // Child process
-            if (res == 0) res = simple_shell_redirect(args, redir_argv);
-            if (res == 0) res = simple_shell_pipe(args);
-            if (res == 0) execvp(args[0], args);
-            exit(EXIT_SUCCESS);
+            exec_child_command(args, redir_argv);
 
         } else if (pid < 0) { // Khi mà việc tạo tiến trình con bị lỗi
             perror("Error: Error forking");
@@ -597,9 +606,63 @@ void exec_command(char **args, char **redir_argv, int wait, int res) {
             // printf("[LOGGING] Parent pid = <%d> spawned a child pid = <%d>.\n", getpid(), pid);
             if (wait == 1) {
                 waitpid(pid, &status, WUNTRACED); // 
+                if (WIFEXITED(status)) {
+                    exit_status = WEXITSTATUS(status);
+                } else if (WIFSIGNALED(status)) {
+                    exit_status = 128 + WTERMSIG(status);
+                }
             }
         }
     }
+    prompt_set_status(exit_status);
+    script_set_status(exit_status);
+    return exit_status;
+}
+
+/**
+ * @description Hàm để scripting layer chạy lệnh qua đúng đường exec_command (builtin, redirect, pipe)
+ * @param argv mảng chuỗi arg đã được mở rộng biến, wait có chờ tiến trình con hay không
+ * @return exit status của lệnh
+ */
+int script_exec_command(char **argv, int wait) {
+    char *redir_argv[REDIR_SIZE];
+    return exec_command(argv, redir_argv, wait, 0);
+}
+
+/**
+ * @description Chạy lệnh mà không chờ, trong process group riêng để có thể hủy cả pipeline (dùng cho on-change)
+ * @param args mảng chuỗi chứa những chuỗi arg để thực hiện lệnh
+ * @return pid của tiến trình con, 0 nếu là builtin (đã chạy xong), -1 nếu lỗi
+ */
+pid_t launch_command(char **args) {
+    char *redir_argv[REDIR_SIZE];
+    int status;
+
+    // Builtins change the shell itself (cd, exit), so they run here and now
+    int i = find_builtin(args[0]);
+    if (i >= 0) {
+        (*builtin_func[i])(args);
+        return 0;
+    }
+
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid == 0) {
+        setpgid(0, 0);
+        // Functions and source run in this child like any other job, so they can be cancelled too
+        signal(SIGINT, SIG_DFL);
+        signal(SIGCHLD, SIG_DFL);
+        if (dispatch_in_shell(args, &status)) {
+            exit(status);
+        }
+        exec_child_command(args, redir_argv);
+    } else if (pid < 0) {
+        perror("Error: Error forking");
+        return -1;
+    }
+    // Set it from both sides so kill(-pid) works no matter who runs first
+    setpgid(pid, pid);
+    return pid;
 }
 
 /**
@@ -622,12 +685,14 @@ int main(void) {
     int wait;
     // Initialize the shell banner and other startup info
     init_shell();
+    prompt_init();
+    script_init(script_exec_command, builtin_str, simple_shell_num_builtins());
     int res = 0;
 
     // Shell main loop
     while (running) {
-        // Display prompt with current time and directory
-        printf("%s:%s> ", prompt(), get_current_dir());
+        // Display prompt with current time, user, directory and git state
+        printf("%s", prompt());
         fflush(stdout);
 
         // Read the command line from the user
@@ -659,14 +724,22 @@ int main(void) {
             get_ai_response(prompt_buffer, ai_response, sizeof(ai_response));
             printf("\n🤖 AI says:\n%s\n", ai_response);
             continue; // Go to next loop iteration
+        } else if (script_wants_line(t_line)) {
+            // Blocks, functions, variables: compiled once, extra lines of a block are read from stdin
+            // The whole block (not just its first line) is saved to history
+            prompt_set_status(script_eval(t_line, stdin, history, MAX_LINE_LENGTH));
         } else {
             // Save the current command to history and execute it
             set_prev_command(history, t_line);
             exec_command(args, redir_argv, wait, res);
         }
 
+        // The command may have touched the repository: refresh git state in the background
+        prompt_refresh();
+
         // Reset result for next iteration
         res = 0;
     }
+    prompt_shutdown();
     return 0;
 }
@@ -0,0 +1,411 @@
+// on_change.c
+//
+// on-change [-d ms] <paths...> -- <command>
+//
+// Watches the given files and directory trees with inotify and reruns the
+// command whenever something changes. The shell sleeps in poll() between
+// events, bursts of events are coalesced over a debounce window, and a run
+// that is still going when the next one is due gets cancelled first.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include "on_change.h"
+
+#ifdef __linux__
+
+#include <limits.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+#define DIR_MASK (IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+                  IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+#define FILE_MASK (IN_CLOSE_WRITE | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF)
+
+typedef struct {
+    char *path;
+    int wd;
+} root_t;
+
+typedef struct {
+    int fd;
+    char **paths;       // indexed by watch descriptor, NULL when unused
+    int cap;
+    int count;
+    root_t *roots;
+    int nroots;
+    int limit_warned;
+} watcher_t;
+
+static int sig_pipe[2] = { -1, -1 };
+static volatile sig_atomic_t interrupted = 0;
+
+static void on_signal(int sig) {
+    int saved_errno = errno;
+    if (sig == SIGINT) {
+        interrupted = 1;
+    }
+    // Wakes up poll(); the pipe is non-blocking so a full pipe is harmless
+    ssize_t ignored = write(sig_pipe[1], "x", 1);
+    (void)ignored;
+    errno = saved_errno;
+}
+
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @description Thêm một inotify watch và ghi nhớ đường dẫn theo watch descriptor
+ * @param w watcher, path đường dẫn, mask các sự kiện cần theo dõi
+ * @return watch descriptor, -1 nếu thất bại
+ */
+static int add_watch(watcher_t *w, const char *path, uint32_t mask) {
+    int wd = inotify_add_watch(w->fd, path, mask);
+    if (wd < 0) {
+        if (errno == ENOSPC && !w->limit_warned) {
+            fprintf(stderr, "Error: on-change: inotify watch limit reached, raise fs.inotify.max_user_watches\n");
+            w->limit_warned = 1;
+        }
+        return -1;
+    }
+    if (wd >= w->cap) {
+        int cap = w->cap ? w->cap : 64;
+        while (cap <= wd) {
+            cap *= 2;
+        }
+        char **paths = realloc(w->paths, cap * sizeof(char *));
+        if (paths == NULL) {
+            perror("Error: Unable to locate memory");
+            exit(EXIT_FAILURE);
+        }
+        memset(paths + w->cap, 0, (cap - w->cap) * sizeof(char *));
+        w->paths = paths;
+        w->cap = cap;
+    }
+    // The same inode watched twice returns the same descriptor
+    if (w->paths[wd] == NULL) {
+        w->count++;
+    }
+    free(w->paths[wd]);
+    w->paths[wd] = strdup(path);
+    return wd;
+}
+
+/**
+ * @description Theo dõi đệ quy một cây thư mục. Chỉ thư mục mới cần watch, file không bị stat;
+ * bỏ qua symlink và thư mục .git.
+ * @param w watcher, path thư mục gốc
+ * @return watch descriptor của path, -1 nếu thất bại
+ */
+static int add_tree(watcher_t *w, const char *path) {
+    char child[PATH_MAX];
+    struct dirent *de;
+    struct stat st;
+
+    int wd = add_watch(w, path, DIR_MASK);
+    if (wd < 0) {
+        return -1;
+    }
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        return wd;
+    }
+    while ((de = readdir(dir)) != NULL) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0 || strcmp(de->d_name, ".git") == 0) {
+            continue;
+        }
+        if (snprintf(child, sizeof(child), "%s/%s", path, de->d_name) >= (int)sizeof(child)) {
+            continue;
+        }
+        int is_dir = de->d_type == DT_DIR;
+        if (de->d_type == DT_UNKNOWN) {
+            is_dir = lstat(child, &st) == 0 && S_ISDIR(st.st_mode);
+        }
+        if (is_dir) {
+            add_tree(w, child);
+        }
+    }
+    closedir(dir);
+    return wd;
+}
+
+static int watch_root(watcher_t *w, root_t *root) {
+    struct stat st;
+
+    if (stat(root->path, &st) != 0) {
+        root->wd = -1;
+        return -1;
+    }
+    root->wd = S_ISDIR(st.st_mode) ? add_tree(w, root->path) : add_watch(w, root->path, FILE_MASK);
+    return root->wd;
+}
+
+// Editors often replace a file by renaming over it, which drops its watch
+static void rewatch_roots(watcher_t *w) {
+    for (int i = 0; i < w->nroots; i++) {
+        root_t *root = &w->roots[i];
+        if (root->wd < 0 || root->wd >= w->cap || w->paths[root->wd] == NULL) {
+            watch_root(w, root);
+        }
+    }
+}
+
+/**
+ * @description Đọc hết các sự kiện đang chờ, thêm watch cho thư mục mới tạo
+ * @param w watcher
+ * @return 1 nếu có thay đổi cần chạy lại lệnh, 0 nếu không
+ */
+static int read_events(watcher_t *w) {
+    char buf[8192] __attribute__((aligned(__alignof__(struct inotify_event))));
+    char child[PATH_MAX];
+    int changed = 0;
+
+    for (;;) {
+        ssize_t len = read(w->fd, buf, sizeof(buf));
+        if (len <= 0) {
+            break;
+        }
+        for (char *p = buf; p < buf + len; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len) {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+
+            if (ev->mask & IN_Q_OVERFLOW) {
+                // Events were lost, including possibly new directories
+                for (int i = 0; i < w->nroots; i++) {
+                    watch_root(w, &w->roots[i]);
+                }
+                changed = 1;
+                continue;
+            }
+            if (ev->wd < 0 || ev->wd >= w->cap || w->paths[ev->wd] == NULL) {
+                continue;
+            }
+            if (ev->mask & IN_IGNORED) {
+                free(w->paths[ev->wd]);
+                w->paths[ev->wd] = NULL;
+                w->count--;
+                continue;
+            }
+            if (ev->len > 0 && strcmp(ev->name, ".git") == 0) {
+                continue;
+            }
+            if ((ev->mask & IN_ISDIR) && (ev->mask & (IN_CREATE | IN_MOVED_TO)) &&
+                snprintf(child, sizeof(child), "%s/%s", w->paths[ev->wd], ev->name) < (int)sizeof(child)) {
+                add_tree(w, child);
+            }
+            changed = 1;
+        }
+    }
+    return changed;
+}
+
+static void report_status(int status) {
+    if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "on-change: command exited with status %d\n", WEXITSTATUS(status));
+    } else if (WIFSIGNALED(status)) {
+        fprintf(stderr, "on-change: command killed by signal %d\n", WTERMSIG(status));
+    }
+}
+
+static void reap_child(pid_t *pid) {
+    int status;
+    if (*pid > 0 && waitpid(*pid, &status, WNOHANG) == *pid) {
+        report_status(status);
+        *pid = 0;
+    }
+}
+
+/**
+ * @description Hủy lần chạy trước: SIGTERM cho cả process group, SIGKILL nếu quá thời gian chờ
+ * @param pid pid của lần chạy trước, được đặt về 0
+ * @return None
+ */
+static void stop_child(pid_t *pid) {
+    int status;
+    long long start = now_ms();
+
+    if (*pid <= 0) {
+        return;
+    }
+    kill(-*pid, SIGTERM);
+    for (;;) {
+        pid_t r = waitpid(*pid, &status, WNOHANG);
+        if (r == *pid || (r < 0 && errno != EINTR)) {
+            break;
+        }
+        if (now_ms() - start >= ON_CHANGE_KILL_GRACE_MS) {
+            kill(-*pid, SIGKILL);
+            while (waitpid(*pid, &status, 0) < 0 && errno == EINTR) {
+            }
+            break;
+        }
+        poll(NULL, 0, 10);
+    }
+    *pid = 0;
+}
+
+static void watcher_free(watcher_t *w) {
+    for (int i = 0; i < w->cap; i++) {
+        free(w->paths[i]);
+    }
+    free(w->paths);
+    free(w->roots);
+    close(w->fd);
+}
+
+static int usage(void) {
+    fprintf(stderr, "Error: Usage: on-change [-d ms] <paths...> -- <command>\n");
+    return 1;
+}
+
+/**
+ * @description Builtin on-change: chạy command một lần, sau đó chạy lại mỗi khi các path thay đổi.
+ * Dừng bằng Ctrl-C.
+ * @param args mảng chuỗi chứa những chuỗi arg, launch hàm chạy lệnh qua đường exec của shell
+ * @return 0 nếu dừng bình thường, 1 nếu lỗi
+ */
+int on_change_command(char **args, on_change_launch_fn launch) {
+    watcher_t w;
+    struct sigaction sa, old_int, old_chld;
+    int debounce = ON_CHANGE_DEBOUNCE_MS;
+    int i;
+    char **argv;
+
+    memset(&w, 0, sizeof(w));
+    for (i = 1; args[i] != NULL && strcmp(args[i], "--") != 0; i++) {
+        if (strcmp(args[i], "-d") == 0) {
+            char *end;
+            if (args[i + 1] == NULL || (debounce = (int)strtol(args[i + 1], &end, 10)) < 0 || *end != '\0') {
+                return usage();
+            }
+            i++;
+        } else {
+            w.nroots++;
+        }
+    }
+    if (args[i] == NULL || args[i + 1] == NULL || w.nroots == 0) {
+        return usage();
+    }
+    argv = &args[i + 1];
+
+    w.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (w.fd < 0) {
+        perror("Error: on-change: inotify_init1 failed");
+        return 1;
+    }
+    w.roots = calloc(w.nroots, sizeof(root_t));
+    if (w.roots == NULL) {
+        perror("Error: Unable to locate memory");
+        exit(EXIT_FAILURE);
+    }
+    w.nroots = 0;
+    for (i = 1; strcmp(args[i], "--") != 0; i++) {
+        if (strcmp(args[i], "-d") == 0) {
+            i++;
+            continue;
+        }
+        root_t *root = &w.roots[w.nroots++];
+        root->path = args[i];
+        if (watch_root(&w, root) < 0) {
+            fprintf(stderr, "Error: on-change: cannot watch %s: %s\n", args[i], strerror(errno));
+            watcher_free(&w);
+            return 1;
+        }
+    }
+
+    if (pipe(sig_pipe) == -1) {
+        perror("Error: Pipe failed");
+        watcher_free(&w);
+        return 1;
+    }
+    for (i = 0; i < 2; i++) {
+        fcntl(sig_pipe[i], F_SETFL, O_NONBLOCK);
+        fcntl(sig_pipe[i], F_SETFD, FD_CLOEXEC);
+    }
+    interrupted = 0;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_NOCLDSTOP;
+    sigaction(SIGINT, &sa, &old_int);
+    sigaction(SIGCHLD, &sa, &old_chld);
+
+    fprintf(stderr, "on-change: watching %d path(s), Ctrl-C to stop\n", w.count);
+    pid_t pid = launch(argv);
+    int pending = 0;
+    long long first = 0, deadline = 0;
+
+    while (!interrupted) {
+        struct pollfd fds[2] = { { w.fd, POLLIN, 0 }, { sig_pipe[0], POLLIN, 0 } };
+        int timeout = -1;
+        if (pending) {
+            long long left = deadline - now_ms();
+            timeout = left > 0 ? (int)left : 0;
+        }
+
+        int n = poll(fds, 2, timeout);
+        if (n < 0 && errno != EINTR) {
+            perror("Error: on-change: poll failed");
+            break;
+        }
+        if (n > 0 && (fds[1].revents & POLLIN)) {
+            char drain[64];
+            while (read(sig_pipe[0], drain, sizeof(drain)) > 0) {
+            }
+            reap_child(&pid);
+        }
+        if (n > 0 && (fds[0].revents & POLLIN) && read_events(&w)) {
+            long long now = now_ms();
+            if (!pending) {
+                pending = 1;
+                first = now;
+            }
+            // Trailing debounce, but a burst that never stops still fires eventually
+            deadline = now + debounce;
+            if (deadline > first + (long long)debounce * ON_CHANGE_MAX_DELAY_FACTOR) {
+                deadline = first + (long long)debounce * ON_CHANGE_MAX_DELAY_FACTOR;
+            }
+        }
+        if (pending && !interrupted && now_ms() >= deadline) {
+            pending = 0;
+            stop_child(&pid);
+            rewatch_roots(&w);
+            pid = launch(argv);
+        }
+    }
+
+    stop_child(&pid);
+    sigaction(SIGINT, &old_int, NULL);
+    sigaction(SIGCHLD, &old_chld, NULL);
+    close(sig_pipe[0]);
+    close(sig_pipe[1]);
+    sig_pipe[0] = sig_pipe[1] = -1;
+    watcher_free(&w);
+    printf("\n");
+    return 0;
+}
+
+#else
+
+int on_change_command(char **args, on_change_launch_fn launch) {
+    (void)args;
+    (void)launch;
+    fprintf(stderr, "Error: on-change needs inotify and is only available on Linux.\n");
+    return 1;
+}
+
+#endif
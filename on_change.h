@@ -0,0 +1,21 @@
+// on_change.h
+
+#ifndef ON_CHANGE_H
+#define ON_CHANGE_H
+
+#include <sys/types.h>
+
+#define ON_CHANGE_DEBOUNCE_MS 100
+// A burst that never goes quiet still fires after this many debounce windows
+#define ON_CHANGE_MAX_DELAY_FACTOR 10
+// Grace period between SIGTERM and SIGKILL when cancelling the previous run
+#define ON_CHANGE_KILL_GRACE_MS 1000
+
+// Starts argv in its own process group and returns its pid, 0 if it already ran
+// to completion (builtins), or -1 on error
+typedef pid_t (*on_change_launch_fn)(char **argv);
+
+// Function prototype
+int on_change_command(char **args, on_change_launch_fn launch);
+
+#endif
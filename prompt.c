@@ -0,0 +1,487 @@
+// prompt.c
+//
+// Prompt engine: every segment (time, user, cwd, git, last exit status) is
+// cached, so rendering the prompt is just a snprintf(). The git segment is
+// computed by a background worker and only ever read here, so a slow
+// `git status` in a huge repository never delays the prompt. While a refresh
+// runs the prompt keeps showing the last result for the same directory, and a
+// directory whose status keeps timing out gets a longer deadline each time.
+
+#ifdef __linux__
+#define _GNU_SOURCE // pipe2()
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <time.h>
+#include <pwd.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include "prompt.h"
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+#define GIT_BRANCH_MAX 128
+#define GIT_SEG_MAX (GIT_BRANCH_MAX + 8)
+#define STATUS_SEG_MAX 16
+
+extern char **environ;
+
+// Segments owned by the main thread
+static char time_seg[32];
+static time_t time_seg_at = (time_t)-1;
+static char user_seg[64];
+static char cwd_seg[PATH_MAX];
+static int cwd_valid = 0;
+static int last_status = 0;
+// Branch read straight from .git for a directory the worker has not reached yet
+static char branch_seg[GIT_BRANCH_MAX];
+static int branch_seg_valid = 0;
+// Room for every segment at full size plus the separators, so nothing is ever cut off
+static char rendered[sizeof(time_seg) + sizeof(user_seg) + PATH_MAX + GIT_SEG_MAX + STATUS_SEG_MAX + 8];
+
+// Git segment, shared with the worker thread under git_lock
+static pthread_mutex_t git_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t git_cond = PTHREAD_COND_INITIALIZER;  // main -> worker: new request
+static pthread_t git_thread;
+static int git_started = 0;
+static int git_stop = 0;
+static unsigned long git_requested = 0;  // bumped by every prompt_refresh()
+static char git_path[PATH_MAX];          // git executable, resolved once by the worker
+static char git_request_dir[PATH_MAX];
+static char git_result_dir[PATH_MAX];    // directory the cached result belongs to
+static char git_branch[GIT_BRANCH_MAX];  // "" when not inside a repository
+static int git_dirty = -1;               // 1 dirty, 0 clean, -1 unknown
+
+/**
+ * @description Đọc dòng đầu tiên của một file nhỏ (HEAD, .git file của worktree)
+ * @param path đường dẫn file, buf bộ đệm kết quả, size kích thước bộ đệm
+ * @return 0 nếu thành công, -1 nếu thất bại
+ */
+static int read_first_line(const char *path, char *buf, size_t size) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        return -1;
+    }
+    char *ret = fgets(buf, (int)size, fp);
+    fclose(fp);
+    if (ret == NULL) {
+        return -1;
+    }
+    buf[strcspn(buf, "\r\n")] = '\0';
+    return 0;
+}
+
+/**
+ * @description Tìm thư mục .git gần nhất tính từ dir đi lên và đọc tên branch từ HEAD.
+ * Không chạy tiến trình git nào, chỉ đọc file.
+ * @param dir thư mục bắt đầu, branch bộ đệm chứa tên branch, size kích thước bộ đệm
+ * @return 0 nếu dir nằm trong một repository, -1 nếu không
+ */
+static int git_read_branch(const char *dir, char *branch, size_t size) {
+    char path[PATH_MAX];
+    char git_dir[PATH_MAX];
+    char line[PATH_MAX];
+    const char *name;
+    struct stat st;
+    size_t len;
+
+    if ((size_t)snprintf(path, sizeof(path), "%s", dir) >= sizeof(path)) {
+        return -1;
+    }
+    for (;;) {
+        len = strlen(path);
+        if ((size_t)snprintf(git_dir, sizeof(git_dir), "%s%s.git", path,
+                             (len > 0 && path[len - 1] == '/') ? "" : "/") >= sizeof(git_dir)) {
+            return -1;
+        }
+        if (stat(git_dir, &st) == 0) {
+            break;
+        }
+        // Go up one directory, stop after the root
+        char *slash = strrchr(path, '/');
+        if (slash == NULL || len <= 1) {
+            return -1;
+        }
+        if (slash == path) {
+            path[1] = '\0';
+        } else {
+            *slash = '\0';
+        }
+    }
+
+    // Worktrees and submodules use a ".git" file of the form "gitdir: <path>"
+    if (S_ISREG(st.st_mode)) {
+        if (read_first_line(git_dir, line, sizeof(line)) != 0 || strncmp(line, "gitdir: ", 8) != 0) {
+            return -1;
+        }
+        int n = line[8] == '/' ? snprintf(git_dir, sizeof(git_dir), "%s", line + 8)
+                               : snprintf(git_dir, sizeof(git_dir), "%s/%s", path, line + 8);
+        if (n < 0 || (size_t)n >= sizeof(git_dir)) {
+            return -1;
+        }
+    }
+
+    if ((size_t)snprintf(path, sizeof(path), "%s/HEAD", git_dir) >= sizeof(path) ||
+        read_first_line(path, line, sizeof(line)) != 0) {
+        return -1;
+    }
+    if (strncmp(line, "ref: refs/heads/", 16) == 0) {
+        name = line + 16;
+    } else if (strncmp(line, "ref: ", 5) == 0) {
+        name = line + 5;
+    } else {
+        // Detached HEAD: show the abbreviated commit id
+        line[7] = '\0';
+        name = line;
+    }
+    // Very long branch names are shortened for display
+    len = strlen(name);
+    if (len >= size) {
+        len = size - 1;
+    }
+    memcpy(branch, name, len);
+    branch[len] = '\0';
+    return 0;
+}
+
+/**
+ * @description Tìm git theo PATH một lần, để tiến trình con chỉ cần execve()
+ * @param None
+ * @return None
+ */
+static void git_resolve_path(void) {
+    const char *path = getenv("PATH");
+    char candidate[PATH_MAX];
+
+    git_path[0] = '\0';
+    if (path == NULL) {
+        path = "/usr/bin:/bin";
+    }
+    while (*path != '\0') {
+        size_t len = strcspn(path, ":");
+        int n = snprintf(candidate, sizeof(candidate), "%.*s/git", (int)(len ? len : 1), len ? path : ".");
+        if (n > 0 && (size_t)n < sizeof(candidate) && access(candidate, X_OK) == 0) {
+            memcpy(git_path, candidate, (size_t)n + 1);
+            return;
+        }
+        path += len;
+        if (*path == ':') {
+            path++;
+        }
+    }
+}
+
+static long elapsed_ms(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000L + (now.tv_nsec - start->tv_nsec) / 1000000L;
+}
+
+/**
+ * @description Chạy `git status --porcelain` với deadline cho trước.
+ * Chỉ cần một byte output là đủ kết luận repository đang dirty.
+ * @param dir thư mục làm việc, deadline_ms thời gian tối đa cho git
+ * @return 1 nếu dirty, 0 nếu clean, -1 nếu lỗi, -2 nếu quá deadline
+ */
+static int git_read_dirty(const char *dir, long deadline_ms) {
+    int fd[2];
+    int result = -2;
+    int status;
+    char buf[64];
+    struct timespec start;
+
+    if (git_path[0] == '\0') {
+        return -1;
+    }
+    // Commands forked by the main thread at the same time must not inherit the
+    // write end, or the read below never sees EOF
+#ifdef __linux__
+    if (pipe2(fd, O_CLOEXEC) == -1) {
+        return -1;
+    }
+#else
+    // No pipe2() here (macOS): a fork in the main thread between these calls can still leak fd[1]
+    if (pipe(fd) == -1) {
+        return -1;
+    }
+    fcntl(fd[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fd[1], F_SETFD, FD_CLOEXEC);
+#endif
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fd[0]);
+        close(fd[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        // Only async-signal-safe calls between fork() and execve() in a threaded process,
+        // which is why git was looked up on PATH beforehand instead of using execvp()
+        char *git_argv[] = { "git", "-C", (char *)dir, "--no-optional-locks", "status",
+                             "--porcelain", "--untracked-files=no", NULL };
+        int null_fd = open("/dev/null", O_RDWR);
+        if (null_fd != -1) {
+            dup2(null_fd, STDIN_FILENO);
+            dup2(null_fd, STDERR_FILENO);
+        }
+        dup2(fd[1], STDOUT_FILENO);
+        execve(git_path, git_argv, environ);
+        _exit(127);
+    }
+    close(fd[1]);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (;;) {
+        long left = deadline_ms - elapsed_ms(&start);
+        if (left <= 0) {
+            break;
+        }
+        struct pollfd pfd = { fd[0], POLLIN, 0 };
+        int ready = poll(&pfd, 1, (int)left);
+        if (ready < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ready < 0) {
+            result = -1;
+        }
+        if (ready <= 0) {
+            break;
+        }
+        ssize_t n = read(fd[0], buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        result = n > 0 ? 1 : (n == 0 ? 0 : -1);
+        break;
+    }
+    close(fd[0]);
+
+    if (result != 0) {
+        // Dirty, timed out or failed: no need to let git finish
+        kill(pid, SIGKILL);
+    }
+    while (waitpid(pid, &status, 0) == -1 && errno == EINTR) {
+    }
+    if (result == 0 && !(WIFEXITED(status) && WEXITSTATUS(status) == 0)) {
+        result = -1;
+    }
+    return result;
+}
+
+/**
+ * @description Ghi kết quả của worker vào cache mà prompt() đọc
+ * @param dir thư mục, branch tên branch, dirty trạng thái dirty
+ * @return None
+ */
+static void git_publish(const char *dir, const char *branch, int dirty) {
+    pthread_mutex_lock(&git_lock);
+    memcpy(git_result_dir, dir, sizeof(git_result_dir));
+    memcpy(git_branch, branch, sizeof(git_branch));
+    git_dirty = dirty;
+    pthread_mutex_unlock(&git_lock);
+}
+
+/**
+ * @description Worker nền: chờ yêu cầu refresh, tính lại segment git rồi ghi vào cache.
+ * Các yêu cầu đến trong lúc đang chạy được gộp lại thành một lần chạy tiếp theo.
+ * Khi `git status` quá deadline, kết quả cũ của cùng thư mục được giữ lại và deadline
+ * của thư mục đó tăng gấp đôi; quá PROMPT_GIT_MAX_DEADLINE_MS thì thôi không chạy nữa
+ * cho đến khi chuyển sang thư mục khác.
+ */
+static void *git_worker(void *arg) {
+    char dir[PATH_MAX];
+    char last_dir[PATH_MAX] = "";
+    char branch[GIT_BRANCH_MAX];
+    unsigned long seen = 0;
+    long deadline = PROMPT_GIT_DEADLINE_MS;
+    int known = -1;  // last clean/dirty result for last_dir
+    (void)arg;
+
+    git_resolve_path();
+    pthread_mutex_lock(&git_lock);
+    while (!git_stop) {
+        if (seen == git_requested) {
+            pthread_cond_wait(&git_cond, &git_lock);
+            continue;
+        }
+        seen = git_requested;
+        memcpy(dir, git_request_dir, sizeof(dir));
+        pthread_mutex_unlock(&git_lock);
+
+        if (strcmp(dir, last_dir) != 0) {
+            memcpy(last_dir, dir, sizeof(last_dir));
+            deadline = PROMPT_GIT_DEADLINE_MS;
+            known = -1;
+        }
+        if (git_read_branch(dir, branch, sizeof(branch)) != 0) {
+            branch[0] = '\0';
+            known = -1;
+        } else if (deadline <= PROMPT_GIT_MAX_DEADLINE_MS) {
+            // Branch first: it is cheap, and a checkout should not wait for status
+            git_publish(dir, branch, known);
+            int dirty = git_read_dirty(dir, deadline);
+            if (dirty == -2) {
+                deadline *= 2;
+            } else {
+                known = dirty;
+            }
+        }
+        git_publish(dir, branch, known);
+        pthread_mutex_lock(&git_lock);
+    }
+    pthread_mutex_unlock(&git_lock);
+    return NULL;
+}
+
+/**
+ * @description Khởi tạo các segment cố định và worker git
+ * @param None
+ * @return None
+ */
+void prompt_init(void) {
+    const char *username = getenv("USER");
+    if (username == NULL) {
+        struct passwd *pw = getpwuid(getuid());
+        username = pw != NULL ? pw->pw_name : "?";
+    }
+    snprintf(user_seg, sizeof(user_seg), "%s", username);
+
+    if (pthread_create(&git_thread, NULL, git_worker, NULL) == 0) {
+        git_started = 1;
+    }
+    prompt_refresh();
+}
+
+/**
+ * @description Thư mục hiện tại, chỉ gọi getcwd() lại sau khi cd
+ * @param None
+ * @return chuỗi đường dẫn (bộ đệm tĩnh)
+ */
+const char *prompt_cwd(void) {
+    if (!cwd_valid) {
+        if (getcwd(cwd_seg, sizeof(cwd_seg)) == NULL) {
+            snprintf(cwd_seg, sizeof(cwd_seg), "?");
+        }
+        cwd_valid = 1;
+    }
+    return cwd_seg;
+}
+
+/**
+ * @description Tạo Shell Prompt dạng YYYY-MM-dd hour:minute:second user:cwd (branch*) [status]>
+ * @param None
+ * @return chuỗi prompt (bộ đệm tĩnh)
+ */
+const char *prompt(void) {
+    char git_seg[GIT_SEG_MAX] = "";
+    char status_seg[STATUS_SEG_MAX] = "";
+    const char *cwd = prompt_cwd();
+
+    // strftime() only once per second
+    time_t now = time(NULL);
+    if (now != time_seg_at) {
+        struct tm *tmp = localtime(&now);
+        if (tmp == NULL || strftime(time_seg, sizeof(time_seg), PROMPT_TIME_FORMAT, tmp) == 0) {
+            time_seg[0] = '\0';
+        }
+        time_seg_at = now;
+    }
+
+    // Never wait for the worker: a refresh still running shows the last result for
+    // this directory, and "?" marks a dirty state that is not known yet
+    pthread_mutex_lock(&git_lock);
+    int have_result = strcmp(git_result_dir, cwd) == 0;
+    if (have_result && git_branch[0] != '\0') {
+        snprintf(git_seg, sizeof(git_seg), " (%s%s)", git_branch,
+                 git_dirty < 0 ? "?" : (git_dirty > 0 ? "*" : ""));
+    }
+    pthread_mutex_unlock(&git_lock);
+
+    // Right after cd the worker has nothing for this directory yet: HEAD is only
+    // a file read away, so show the branch now and leave the dirty state pending
+    if (!have_result && git_started) {
+        if (!branch_seg_valid) {
+            if (git_read_branch(cwd, branch_seg, sizeof(branch_seg)) != 0) {
+                branch_seg[0] = '\0';
+            }
+            branch_seg_valid = 1;
+        }
+        if (branch_seg[0] != '\0') {
+            snprintf(git_seg, sizeof(git_seg), " (%s?)", branch_seg);
+        }
+    }
+
+    if (last_status != 0) {
+        snprintf(status_seg, sizeof(status_seg), " [%d]", last_status);
+    }
+
+    snprintf(rendered, sizeof(rendered), "%s %s:%s%s%s> ",
+             time_seg, user_seg, cwd, git_seg, status_seg);
+    return rendered;
+}
+
+/**
+ * @description Ghi nhận exit status của lệnh vừa chạy
+ * @param status exit status
+ * @return None
+ */
+void prompt_set_status(int status) {
+    last_status = status;
+}
+
+/**
+ * @description Gọi sau khi chdir() thành công
+ * @param None
+ * @return None
+ */
+void prompt_cwd_changed(void) {
+    cwd_valid = 0;
+    branch_seg_valid = 0;
+    prompt_refresh();
+}
+
+/**
+ * @description Yêu cầu worker tính lại segment git, không chờ kết quả
+ * @param None
+ * @return None
+ */
+void prompt_refresh(void) {
+    const char *cwd = prompt_cwd();
+    if (!git_started) {
+        return;
+    }
+    pthread_mutex_lock(&git_lock);
+    snprintf(git_request_dir, sizeof(git_request_dir), "%s", cwd);
+    git_requested++;
+    pthread_cond_signal(&git_cond);
+    pthread_mutex_unlock(&git_lock);
+}
+
+/**
+ * @description Dừng worker git
+ * @param None
+ * @return None
+ */
+void prompt_shutdown(void) {
+    if (!git_started) {
+        return;
+    }
+    pthread_mutex_lock(&git_lock);
+    git_stop = 1;
+    pthread_cond_signal(&git_cond);
+    pthread_mutex_unlock(&git_lock);
+    pthread_join(git_thread, NULL);
+    git_started = 0;
+}
@@ -0,0 +1,21 @@
+// prompt.h
+
+#ifndef PROMPT_H
+#define PROMPT_H
+
+#define PROMPT_TIME_FORMAT "%F %T"
+// How long the background worker lets `git status` run before giving up.
+// Each timeout doubles it for that directory, up to PROMPT_GIT_MAX_DEADLINE_MS
+#define PROMPT_GIT_DEADLINE_MS 300
+#define PROMPT_GIT_MAX_DEADLINE_MS 5000
+
+// Function prototypes
+void prompt_init(void);
+const char *prompt(void);
+const char *prompt_cwd(void);
+void prompt_set_status(int status);
+void prompt_cwd_changed(void);
+void prompt_refresh(void);
+void prompt_shutdown(void);
+
+#endif
@@ -0,0 +1,1849 @@
+// script.c
+//
+// Scripting layer: if/while/until/for blocks, functions, variables and
+// $((...)) arithmetic. Source text is compiled once into a flat array of
+// instructions (a "chunk"); loops and function calls then run that array
+// directly without re-tokenizing anything. Each command keeps its words
+// pre-split into literal and variable parts, and external programs keep the
+// executable path that was resolved at compile time.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include "script.h"
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+#define ARITH_STACK 64
+#define SCRIPT_LINE_LENGTH 1024
+
+// ############################## COMPILED FORM #########################################
+
+enum part_kind { PART_LIT, PART_VAR, PART_POS, PART_STATUS, PART_ARGC, PART_ALL, PART_ARITH };
+
+enum arith_opcode {
+    A_NUM, A_VAR, A_POS, A_NEG, A_NOT,
+    A_MUL, A_DIV, A_MOD, A_ADD, A_SUB, A_LT, A_LE, A_GT, A_GE, A_EQ, A_NE
+};
+
+typedef struct {
+    int op;
+    long val;          // constant, variable slot or positional index
+} arith_op_t;
+
+// Arithmetic expression in postfix order
+typedef struct {
+    int n;
+    arith_op_t *ops;
+} arith_t;
+
+typedef struct {
+    int kind;
+    int n;             // variable slot or positional index
+    char *text;        // PART_LIT
+    arith_t *expr;     // PART_ARITH
+} part_t;
+
+typedef struct {
+    char *literal;     // set when the word needs no expansion at all
+    int splat;         // the word is exactly "$@"
+    int nparts;
+    part_t *parts;
+} word_t;
+
+enum cmd_kind { CMD_EXTERNAL, CMD_SHELL, CMD_TEST, CMD_TRUE, CMD_FALSE, CMD_SOURCE, CMD_DYNAMIC };
+
+typedef struct {
+    int kind;
+    int wait;
+    int redirect;      // uses < > >> or |, always goes through the shell
+    int argc;
+    word_t *words;
+    char *path;        // resolved at compile time, NULL falls back to execvp
+    unsigned fn_gen;   // function table generation fn_index was looked up in
+    int fn_index;
+} cmd_t;
+
+enum opcode {
+    OP_CMD,        // p = cmd_t
+    OP_ASSIGN,     // a = variable slot, p = word_t
+    OP_JUMP,       // a = target
+    OP_JUMP_FALSE, // a = target, taken when the last status != 0
+    OP_JUMP_TRUE,  // a = target, taken when the last status == 0
+    OP_FOR_INIT,   // a = loop depth, p = cmd_t holding the word list
+    OP_FOR_NEXT,   // a = loop depth, b = variable slot, c = target once exhausted
+    OP_FOR_POP,    // a = loop depth
+    OP_DEFUN,      // p = defun_t
+    OP_RETURN,     // p = word_t, or NULL to keep the last status
+    OP_STATUS,     // a = new last status
+    OP_SAVE,       // a = loop slot, remembers the last status
+    OP_RESTORE     // a = loop slot, brings the remembered status back
+};
+
+typedef struct {
+    int op;
+    int a, b, c;
+    void *p;
+} instr_t;
+
+typedef struct {
+    instr_t *code;
+    int n, cap;
+    int refs;
+} chunk_t;
+
+typedef struct {
+    char *name;
+    chunk_t *body;
+} defun_t;
+
+// ############################## RUNTIME STATE #########################################
+
+typedef struct {
+    char *name;
+    char *value;       // NULL falls back to the environment
+} var_t;
+
+typedef struct {
+    char *name;
+    chunk_t *body;
+} func_t;
+
+// Positional parameters: argv[0] is $0
+typedef struct {
+    int argc;
+    char **argv;
+} frame_t;
+
+typedef struct {
+    char buf[SCRIPT_EXPAND_SIZE];
+    size_t len;
+    char *argv[SCRIPT_MAX_ARGS + 1];
+    int argc;
+} expansion_t;
+
+static var_t *vars = NULL;
+static int nvars = 0, vars_cap = 0;
+static func_t *funcs = NULL;
+static int nfuncs = 0, funcs_cap = 0;
+static unsigned fn_gen = 1;          // bumped whenever a function is (re)defined
+static int last_status = 0;
+static int call_depth = 0;
+
+static script_exec_fn shell_exec = NULL;
+static char **shell_builtins = NULL;
+static int shell_num_builtins = 0;
+
+static char *top_argv[] = { "miniShell", NULL };
+static const frame_t top_frame = { 1, top_argv };
+
+static int vm_run(chunk_t *c, const frame_t *f);
+static int builtin_source(int argc, char **argv);
+
+// ############################## HELPERS ###############################################
+
+static void *xrealloc(void *ptr, size_t size) {
+    void *p = realloc(ptr, size);
+    if (p == NULL) {
+        perror("Error: Unable to locate memory");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+static char *xstrndup(const char *s, size_t len) {
+    char *p = xrealloc(NULL, len + 1);
+    memcpy(p, s, len);
+    p[len] = '\0';
+    return p;
+}
+
+static char *xstrdup(const char *s) {
+    return xstrndup(s, strlen(s));
+}
+
+static int is_name(const char *s, size_t len) {
+    if (len == 0 || !(isalpha((unsigned char)s[0]) || s[0] == '_')) {
+        return 0;
+    }
+    for (size_t i = 1; i < len; i++) {
+        if (!(isalnum((unsigned char)s[i]) || s[i] == '_')) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int is_assignment(const char *word) {
+    const char *eq = strchr(word, '=');
+    return eq != NULL && is_name(word, (size_t)(eq - word));
+}
+
+static int in_list(const char *word, const char *const *list) {
+    for (int i = 0; list[i] != NULL; i++) {
+        if (strcmp(word, list[i]) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int wait_status(int status) {
+    if (WIFEXITED(status)) {
+        return WEXITSTATUS(status);
+    }
+    if (WIFSIGNALED(status)) {
+        return 128 + WTERMSIG(status);
+    }
+    return 0;
+}
+
+// ############################## VARIABLES & FUNCTIONS #################################
+
+/**
+ * @description Tìm (hoặc tạo) slot của biến. Chỉ gọi lúc compile, lúc chạy chỉ dùng index.
+ * @param name tên biến, len độ dài tên
+ * @return index của slot
+ */
+static int var_slot(const char *name, size_t len) {
+    for (int i = 0; i < nvars; i++) {
+        if (strlen(vars[i].name) == len && strncmp(vars[i].name, name, len) == 0) {
+            return i;
+        }
+    }
+    if (nvars == vars_cap) {
+        vars_cap = vars_cap ? vars_cap * 2 : 16;
+        vars = xrealloc(vars, vars_cap * sizeof(var_t));
+    }
+    vars[nvars].name = xstrndup(name, len);
+    vars[nvars].value = NULL;
+    return nvars++;
+}
+
+static const char *var_get(int slot) {
+    if (vars[slot].value != NULL) {
+        return vars[slot].value;
+    }
+    const char *env = getenv(vars[slot].name);
+    return env != NULL ? env : "";
+}
+
+static void var_set(int slot, const char *value) {
+    char *copy = xstrdup(value);
+    free(vars[slot].value);
+    vars[slot].value = copy;
+}
+
+static int func_find(const char *name) {
+    for (int i = 0; i < nfuncs; i++) {
+        if (strcmp(funcs[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void chunk_release(chunk_t *c);
+
+static void func_define(const char *name, chunk_t *body) {
+    int i = func_find(name);
+    body->refs++;
+    if (i >= 0) {
+        chunk_release(funcs[i].body);
+        funcs[i].body = body;
+    } else {
+        if (nfuncs == funcs_cap) {
+            funcs_cap = funcs_cap ? funcs_cap * 2 : 8;
+            funcs = xrealloc(funcs, funcs_cap * sizeof(func_t));
+        }
+        funcs[nfuncs].name = xstrdup(name);
+        funcs[nfuncs].body = body;
+        nfuncs++;
+    }
+    fn_gen++;
+}
+
+// ############################## CHUNKS ################################################
+
+static chunk_t *chunk_new(void) {
+    chunk_t *c = xrealloc(NULL, sizeof(chunk_t));
+    c->code = NULL;
+    c->n = 0;
+    c->cap = 0;
+    c->refs = 1;
+    return c;
+}
+
+static int emit(chunk_t *c, int op, int a, int b, void *p) {
+    if (c->n == c->cap) {
+        c->cap = c->cap ? c->cap * 2 : 16;
+        c->code = xrealloc(c->code, c->cap * sizeof(instr_t));
+    }
+    c->code[c->n].op = op;
+    c->code[c->n].a = a;
+    c->code[c->n].b = b;
+    c->code[c->n].c = -1;
+    c->code[c->n].p = p;
+    return c->n++;
+}
+
+// Jumps that still need a target are chained through their 'a' field
+static void patch_chain(chunk_t *c, int head, int target) {
+    while (head != -1) {
+        int next = c->code[head].a;
+        c->code[head].a = target;
+        head = next;
+    }
+}
+
+static void arith_free(arith_t *e) {
+    if (e != NULL) {
+        free(e->ops);
+        free(e);
+    }
+}
+
+static void word_clear(word_t *w) {
+    for (int i = 0; i < w->nparts; i++) {
+        free(w->parts[i].text);
+        arith_free(w->parts[i].expr);
+    }
+    free(w->parts);
+    free(w->literal);
+    memset(w, 0, sizeof(*w));
+}
+
+static void cmd_free(cmd_t *cmd) {
+    for (int i = 0; i < cmd->argc; i++) {
+        word_clear(&cmd->words[i]);
+    }
+    free(cmd->words);
+    free(cmd->path);
+    free(cmd);
+}
+
+static void chunk_release(chunk_t *c) {
+    if (c == NULL || --c->refs > 0) {
+        return;
+    }
+    for (int i = 0; i < c->n; i++) {
+        instr_t *in = &c->code[i];
+        switch (in->op) {
+        case OP_CMD:
+        case OP_FOR_INIT:
+            cmd_free(in->p);
+            break;
+        case OP_ASSIGN:
+        case OP_RETURN:
+            if (in->p != NULL) {
+                word_clear(in->p);
+                free(in->p);
+            }
+            break;
+        case OP_DEFUN: {
+            defun_t *d = in->p;
+            free(d->name);
+            chunk_release(d->body);
+            free(d);
+            break;
+        }
+        default:
+            break;
+        }
+    }
+    free(c->code);
+    free(c);
+}
+
+// ############################## TOKENIZER #############################################
+
+enum tok_type { T_WORD, T_SEP, T_EOF };
+
+typedef struct {
+    int type;
+    int line;
+    char *text;
+} tok_t;
+
+// Returns a pointer just past the "))" closing a "$((", or NULL
+static const char *arith_end(const char *s) {
+    int depth = 2;
+    for (; *s != '\0'; s++) {
+        if (*s == '(') {
+            depth++;
+        } else if (*s == ')' && --depth == 0) {
+            return s + 1;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @description Tách source thành các token: word, dấu phân cách (';' hoặc xuống dòng) và EOF.
+ * Không hỗ trợ quote, giống parse_command(); riêng $((...)) được giữ nguyên kể cả khoảng trắng.
+ * @param src chuỗi nguồn, count số token trả về
+ * @return mảng token, kết thúc bằng T_EOF
+ */
+static tok_t *tokenize(const char *src, int *count) {
+    tok_t *toks = NULL;
+    int n = 0, cap = 0, line = 1;
+    const char *s = src;
+
+    for (;;) {
+        while (*s == ' ' || *s == '\t' || *s == '\r') {
+            s++;
+        }
+        if (*s == '#') {
+            while (*s != '\0' && *s != '\n') {
+                s++;
+            }
+        }
+        if (n == cap) {
+            cap = cap ? cap * 2 : 32;
+            toks = xrealloc(toks, cap * sizeof(tok_t));
+        }
+        toks[n].line = line;
+        if (*s == '\0') {
+            toks[n].type = T_EOF;
+            toks[n].text = xstrdup("end of input");
+            n++;
+            break;
+        }
+        if (*s == '\n' || *s == ';') {
+            toks[n].type = T_SEP;
+            toks[n].text = xstrdup(*s == ';' ? ";" : "newline");
+            if (*s == '\n') {
+                line++;
+            }
+            s++;
+            n++;
+            continue;
+        }
+        const char *start = s;
+        while (*s != '\0' && strchr(" \t\r\n;", *s) == NULL) {
+            if (s[0] == '$' && s[1] == '(' && s[2] == '(') {
+                const char *end = arith_end(s + 3);
+                if (end != NULL) {
+                    s = end;
+                    continue;
+                }
+            }
+            s++;
+        }
+        toks[n].type = T_WORD;
+        toks[n].text = xstrndup(start, (size_t)(s - start));
+        n++;
+    }
+    *count = n;
+    return toks;
+}
+
+static void tokens_free(tok_t *toks, int count) {
+    for (int i = 0; i < count; i++) {
+        free(toks[i].text);
+    }
+    free(toks);
+}
+
+// ############################## ARITHMETIC ############################################
+
+typedef struct {
+    const char *s;
+    arith_t *e;
+    int cap;
+    int depth, max_depth;
+} arith_parser_t;
+
+static const struct {
+    const char *tok;
+    int op;
+    int prec;
+} arith_ops[] = {
+    { "<=", A_LE, 3 }, { ">=", A_GE, 3 }, { "==", A_EQ, 2 }, { "!=", A_NE, 2 },
+    { "*", A_MUL, 5 }, { "/", A_DIV, 5 }, { "%", A_MOD, 5 },
+    { "+", A_ADD, 4 }, { "-", A_SUB, 4 }, { "<", A_LT, 3 }, { ">", A_GT, 3 },
+    { NULL, 0, 0 }
+};
+
+static void arith_emit(arith_parser_t *ap, int op, long val) {
+    if (ap->e->n == ap->cap) {
+        ap->cap = ap->cap ? ap->cap * 2 : 8;
+        ap->e->ops = xrealloc(ap->e->ops, ap->cap * sizeof(arith_op_t));
+    }
+    ap->e->ops[ap->e->n].op = op;
+    ap->e->ops[ap->e->n].val = val;
+    ap->e->n++;
+    if (op == A_NUM || op == A_VAR || op == A_POS) {
+        if (++ap->depth > ap->max_depth) {
+            ap->max_depth = ap->depth;
+        }
+    } else if (op != A_NEG && op != A_NOT) {
+        ap->depth--;
+    }
+}
+
+static void arith_skip_space(arith_parser_t *ap) {
+    while (isspace((unsigned char)*ap->s)) {
+        ap->s++;
+    }
+}
+
+static int arith_expr(arith_parser_t *ap, int min_prec);
+
+static int arith_primary(arith_parser_t *ap) {
+    arith_skip_space(ap);
+    const char *s = ap->s;
+
+    if (*s == '-' || *s == '+' || *s == '!') {
+        ap->s++;
+        if (arith_primary(ap) != 0) {
+            return -1;
+        }
+        if (*s != '+') {
+            arith_emit(ap, *s == '-' ? A_NEG : A_NOT, 0);
+        }
+        return 0;
+    }
+    if (*s == '(') {
+        ap->s++;
+        if (arith_expr(ap, 0) != 0) {
+            return -1;
+        }
+        arith_skip_space(ap);
+        if (*ap->s != ')') {
+            return -1;
+        }
+        ap->s++;
+        return 0;
+    }
+    if (isdigit((unsigned char)*s)) {
+        char *end;
+        long val = strtol(s, &end, 10);
+        ap->s = end;
+        arith_emit(ap, A_NUM, val);
+        return 0;
+    }
+    if (*s == '$' && isdigit((unsigned char)s[1])) {
+        ap->s += 2;
+        arith_emit(ap, A_POS, s[1] - '0');
+        return 0;
+    }
+    if (*s == '$') {
+        s++;
+    }
+    const char *name = s;
+    while (isalnum((unsigned char)*s) || *s == '_') {
+        s++;
+    }
+    if (!is_name(name, (size_t)(s - name))) {
+        return -1;
+    }
+    ap->s = s;
+    arith_emit(ap, A_VAR, var_slot(name, (size_t)(s - name)));
+    return 0;
+}
+
+// Precedence climbing, emits operators in postfix order
+static int arith_expr(arith_parser_t *ap, int min_prec) {
+    if (arith_primary(ap) != 0) {
+        return -1;
+    }
+    for (;;) {
+        arith_skip_space(ap);
+        int i;
+        for (i = 0; arith_ops[i].tok != NULL; i++) {
+            if (strncmp(ap->s, arith_ops[i].tok, strlen(arith_ops[i].tok)) == 0) {
+                break;
+            }
+        }
+        if (arith_ops[i].tok == NULL || arith_ops[i].prec < min_prec) {
+            return 0;
+        }
+        ap->s += strlen(arith_ops[i].tok);
+        if (arith_expr(ap, arith_ops[i].prec + 1) != 0) {
+            return -1;
+        }
+        arith_emit(ap, arith_ops[i].op, 0);
+    }
+}
+
+static arith_t *arith_compile(const char *src) {
+    arith_parser_t ap = { src, NULL, 0, 0, 0 };
+    ap.e = xrealloc(NULL, sizeof(arith_t));
+    ap.e->n = 0;
+    ap.e->ops = NULL;
+    if (arith_expr(&ap, 0) != 0 || (arith_skip_space(&ap), *ap.s != '\0') || ap.max_depth > ARITH_STACK) {
+        arith_free(ap.e);
+        return NULL;
+    }
+    return ap.e;
+}
+
+static long arith_value(const char *s) {
+    return strtol(s, NULL, 10);
+}
+
+static int arith_eval(const arith_t *e, const frame_t *f, long *out) {
+    long st[ARITH_STACK];
+    int sp = 0;
+
+    for (int i = 0; i < e->n; i++) {
+        const arith_op_t *op = &e->ops[i];
+        long a, b;
+        switch (op->op) {
+        case A_NUM: st[sp++] = op->val; continue;
+        case A_VAR: st[sp++] = arith_value(var_get((int)op->val)); continue;
+        case A_POS: st[sp++] = op->val < f->argc ? arith_value(f->argv[op->val]) : 0; continue;
+        case A_NEG: st[sp - 1] = (long)(0UL - (unsigned long)st[sp - 1]); continue;
+        case A_NOT: st[sp - 1] = !st[sp - 1]; continue;
+        default: break;
+        }
+        b = st[--sp];
+        a = st[sp - 1];
+        switch (op->op) {
+        // Overflow wraps around instead of being undefined
+        case A_MUL: a = (long)((unsigned long)a * (unsigned long)b); break;
+        case A_DIV:
+        case A_MOD:
+            if (b == 0) {
+                fprintf(stderr, "Error: Division by zero.\n");
+                return -1;
+            }
+            // LONG_MIN / -1 traps on most CPUs: define it like bash does
+            if (a == LONG_MIN && b == -1) {
+                a = op->op == A_DIV ? LONG_MIN : 0;
+            } else {
+                a = op->op == A_DIV ? a / b : a % b;
+            }
+            break;
+        case A_ADD: a = (long)((unsigned long)a + (unsigned long)b); break;
+        case A_SUB: a = (long)((unsigned long)a - (unsigned long)b); break;
+        case A_LT: a = a < b; break;
+        case A_LE: a = a <= b; break;
+        case A_GT: a = a > b; break;
+        case A_GE: a = a >= b; break;
+        case A_EQ: a = a == b; break;
+        case A_NE: a = a != b; break;
+        }
+        st[sp - 1] = a;
+    }
+    *out = st[0];
+    return 0;
+}
+
+// ############################## PARSER / COMPILER #####################################
+
+typedef struct {
+    int is_for;
+    int depth;         // for-loop frame index
+    int continue_at;
+    int breaks;        // chain of break jumps to patch, -1 if none
+} loop_t;
+
+typedef struct {
+    tok_t *toks;
+    int pos;
+    chunk_t *chunk;
+    loop_t loops[SCRIPT_MAX_NESTING];
+    int nloops;
+    int loop_base;     // loops below this belong to an enclosing function
+    int for_depth;
+    int in_function;
+    int incomplete;
+    char err[128];
+} parser_t;
+
+static const char *const reserved_words[] = { "then", "elif", "else", "fi", "do", "done", "}", NULL };
+
+static tok_t *peek(parser_t *p) {
+    return &p->toks[p->pos];
+}
+
+static int at_word(parser_t *p, const char *word) {
+    tok_t *t = peek(p);
+    return t->type == T_WORD && strcmp(t->text, word) == 0;
+}
+
+static int at_end_of_command(parser_t *p) {
+    return peek(p)->type != T_WORD;
+}
+
+static void skip_seps(parser_t *p) {
+    while (peek(p)->type == T_SEP) {
+        p->pos++;
+    }
+}
+
+// Reaching the end of input in the middle of a construct means "need more lines"
+static int fail(parser_t *p, const char *msg) {
+    tok_t *t = peek(p);
+    if (t->type == T_EOF) {
+        p->incomplete = 1;
+        snprintf(p->err, sizeof(p->err), "Unexpected end of input");
+    } else {
+        snprintf(p->err, sizeof(p->err), "line %d: %s near '%s'", t->line, msg, t->text);
+    }
+    return -1;
+}
+
+static int fail_word(parser_t *p, const tok_t *t, const char *msg) {
+    snprintf(p->err, sizeof(p->err), "line %d: %s in '%s'", t->line, msg, t->text);
+    return -1;
+}
+
+static int expect(parser_t *p, const char *word) {
+    char msg[32];
+    skip_seps(p);
+    if (!at_word(p, word)) {
+        snprintf(msg, sizeof(msg), "expected '%s'", word);
+        return fail(p, msg);
+    }
+    p->pos++;
+    return 0;
+}
+
+static void word_add_part(word_t *w, part_t part) {
+    w->parts = xrealloc(w->parts, (w->nparts + 1) * sizeof(part_t));
+    w->parts[w->nparts++] = part;
+}
+
+static void word_add_literal(word_t *w, const char *start, const char *end) {
+    if (end > start) {
+        part_t part = { PART_LIT, 0, xstrndup(start, (size_t)(end - start)), NULL };
+        word_add_part(w, part);
+    }
+}
+
+/**
+ * @description Compile một word thành template: các phần literal, $VAR, ${VAR}, $1..$9,
+ * ${N}, $?, $#, $@, $* và $((...)). Word không có '$' được giữ nguyên dạng literal.
+ * @param p parser, t token chứa word, w kết quả
+ * @return 0 nếu thành công, -1 nếu lỗi cú pháp
+ */
+static int compile_word(parser_t *p, const tok_t *t, word_t *w) {
+    const char *text = t->text;
+    const char *s = text, *lit = text;
+    int expands = 0;
+
+    memset(w, 0, sizeof(*w));
+    if (strchr(text, '$') == NULL) {
+        w->literal = xstrdup(text);
+        return 0;
+    }
+    if (strcmp(text, "$@") == 0) {
+        w->splat = 1;
+        return 0;
+    }
+
+    while (*s != '\0') {
+        part_t part = { PART_LIT, 0, NULL, NULL };
+        const char *next;
+
+        if (*s != '$') {
+            s++;
+            continue;
+        }
+        if (s[1] == '(' && s[2] == '(') {
+            const char *end = arith_end(s + 3);
+            if (end == NULL) {
+                word_clear(w);
+                return fail_word(p, t, "unterminated $((");
+            }
+            char *src = xstrndup(s + 3, (size_t)(end - 2 - (s + 3)));
+            part.kind = PART_ARITH;
+            part.expr = arith_compile(src);
+            free(src);
+            if (part.expr == NULL) {
+                word_clear(w);
+                return fail_word(p, t, "bad arithmetic expression");
+            }
+            next = end;
+        } else if (s[1] == '{') {
+            const char *close = strchr(s + 2, '}');
+            size_t len = close != NULL ? (size_t)(close - (s + 2)) : 0;
+            if (close != NULL && len > 0 && strspn(s + 2, "0123456789") == len) {
+                part.kind = PART_POS;
+                part.n = atoi(s + 2);
+            } else if (close != NULL && is_name(s + 2, len)) {
+                part.kind = PART_VAR;
+                part.n = var_slot(s + 2, len);
+            } else {
+                word_clear(w);
+                return fail_word(p, t, "bad substitution");
+            }
+            next = close + 1;
+        } else if (isdigit((unsigned char)s[1])) {
+            part.kind = PART_POS;
+            part.n = s[1] - '0';
+            next = s + 2;
+        } else if (s[1] == '?' || s[1] == '#' || s[1] == '@' || s[1] == '*') {
+            part.kind = s[1] == '?' ? PART_STATUS : (s[1] == '#' ? PART_ARGC : PART_ALL);
+            next = s + 2;
+        } else if (isalpha((unsigned char)s[1]) || s[1] == '_') {
+            next = s + 1;
+            while (isalnum((unsigned char)*next) || *next == '_') {
+                next++;
+            }
+            part.kind = PART_VAR;
+            part.n = var_slot(s + 1, (size_t)(next - (s + 1)));
+        } else {
+            // A lone '$' stays literal
+            s++;
+            continue;
+        }
+        word_add_literal(w, lit, s);
+        word_add_part(w, part);
+        expands = 1;
+        s = lit = next;
+    }
+    word_add_literal(w, lit, s);
+
+    if (!expands) {
+        word_clear(w);
+        w->literal = xstrdup(text);
+    }
+    return 0;
+}
+
+/**
+ * @description Tìm đường dẫn thực thi theo PATH một lần lúc compile
+ * @param name tên lệnh
+ * @return đường dẫn (cấp phát động) hoặc NULL nếu không tìm thấy
+ */
+static char *resolve_path(const char *name) {
+    char candidate[PATH_MAX];
+    struct stat st;
+
+    if (strchr(name, '/') != NULL) {
+        return xstrdup(name);
+    }
+    const char *path = getenv("PATH");
+    if (path == NULL) {
+        path = "/usr/bin:/bin";
+    }
+    while (*path != '\0') {
+        size_t len = strcspn(path, ":");
+        // An empty PATH entry means the current directory
+        snprintf(candidate, sizeof(candidate), "%.*s/%s", (int)(len ? len : 1), len ? path : ".", name);
+        if (stat(candidate, &st) == 0 && S_ISREG(st.st_mode) && access(candidate, X_OK) == 0) {
+            return xstrdup(candidate);
+        }
+        path += len;
+        if (*path == ':') {
+            path++;
+        }
+    }
+    return NULL;
+}
+
+static int classify(const char *name) {
+    if (strcmp(name, "[") == 0 || strcmp(name, "test") == 0) {
+        return CMD_TEST;
+    }
+    if (strcmp(name, "true") == 0 || strcmp(name, ":") == 0) {
+        return CMD_TRUE;
+    }
+    if (strcmp(name, "false") == 0) {
+        return CMD_FALSE;
+    }
+    if (strcmp(name, "source") == 0 || strcmp(name, ".") == 0) {
+        return CMD_SOURCE;
+    }
+    for (int i = 0; i < shell_num_builtins; i++) {
+        if (strcmp(name, shell_builtins[i]) == 0) {
+            return CMD_SHELL;
+        }
+    }
+    return CMD_EXTERNAL;
+}
+
+static int parse_list(parser_t *p, const char *const *terms);
+
+static int parse_simple(parser_t *p) {
+    int start = p->pos, n = 0, assigns = 0;
+
+    while (peek(p)->type == T_WORD) {
+        assigns += is_assignment(peek(p)->text);
+        p->pos++;
+        n++;
+    }
+    if (n > SCRIPT_MAX_ARGS) {
+        return fail_word(p, &p->toks[start], "too many arguments");
+    }
+
+    // NAME=value [NAME=value ...]
+    if (assigns == n) {
+        for (int i = start; i < start + n; i++) {
+            tok_t value = p->toks[i];
+            const char *eq = strchr(value.text, '=');
+            word_t *w = xrealloc(NULL, sizeof(word_t));
+            value.text = (char *)eq + 1;
+            if (compile_word(p, &value, w) != 0) {
+                free(w);
+                return -1;
+            }
+            emit(p->chunk, OP_ASSIGN, var_slot(p->toks[i].text, (size_t)(eq - p->toks[i].text)), 0, w);
+        }
+        return 0;
+    }
+
+    cmd_t *cmd = xrealloc(NULL, sizeof(cmd_t));
+    memset(cmd, 0, sizeof(*cmd));
+    cmd->words = xrealloc(NULL, n * sizeof(word_t));
+    cmd->wait = 1;
+    cmd->fn_index = -1;
+    for (int i = start; i < start + n; i++) {
+        const char *text = p->toks[i].text;
+        if (i == start + n - 1 && strcmp(text, "&") == 0 && n > 1) {
+            cmd->wait = 0;
+            break;
+        }
+        if (strcmp(text, ">") == 0 || strcmp(text, ">>") == 0 || strcmp(text, "<") == 0 || strcmp(text, "|") == 0) {
+            cmd->redirect = 1;
+        }
+        if (compile_word(p, &p->toks[i], &cmd->words[cmd->argc]) != 0) {
+            cmd_free(cmd);
+            return -1;
+        }
+        cmd->argc++;
+    }
+
+    if (cmd->redirect || !cmd->wait) {
+        cmd->kind = CMD_SHELL;
+    } else if (cmd->words[0].literal == NULL) {
+        cmd->kind = CMD_DYNAMIC;
+    } else {
+        cmd->kind = classify(cmd->words[0].literal);
+        if (cmd->kind == CMD_EXTERNAL) {
+            cmd->path = resolve_path(cmd->words[0].literal);
+        }
+    }
+    emit(p->chunk, OP_CMD, 0, 0, cmd);
+    return 0;
+}
+
+static int push_loop(parser_t *p, int is_for, int continue_at) {
+    if (p->nloops == SCRIPT_MAX_NESTING) {
+        return fail(p, "loops nested too deeply");
+    }
+    loop_t *l = &p->loops[p->nloops++];
+    l->is_for = is_for;
+    l->depth = is_for ? p->for_depth++ : -1;
+    l->continue_at = continue_at;
+    l->breaks = -1;
+    return 0;
+}
+
+// Closes the innermost loop: breaks jump to the current end of the chunk
+static void pop_loop(parser_t *p) {
+    loop_t *l = &p->loops[--p->nloops];
+    if (l->is_for) {
+        p->for_depth--;
+    }
+    patch_chain(p->chunk, l->breaks, p->chunk->n);
+}
+
+static int parse_if(parser_t *p) {
+    static const char *const cond_end[] = { "then", NULL };
+    static const char *const body_end[] = { "elif", "else", "fi", NULL };
+    static const char *const else_end[] = { "fi", NULL };
+    int ends = -1;
+
+    p->pos++;
+    for (;;) {
+        if (parse_list(p, cond_end) != 0 || expect(p, "then") != 0) {
+            return -1;
+        }
+        int skip = emit(p->chunk, OP_JUMP_FALSE, -1, 0, NULL);
+        if (parse_list(p, body_end) != 0) {
+            return -1;
+        }
+        ends = emit(p->chunk, OP_JUMP, ends, 0, NULL);
+        patch_chain(p->chunk, skip, p->chunk->n);
+        if (at_word(p, "fi")) {
+            // No branch taken: the if itself succeeds
+            emit(p->chunk, OP_STATUS, 0, 0, NULL);
+            break;
+        }
+        if (at_word(p, "elif")) {
+            p->pos++;
+            continue;
+        }
+        p->pos++;
+        if (parse_list(p, else_end) != 0) {
+            return -1;
+        }
+        break;
+    }
+    if (expect(p, "fi") != 0) {
+        return -1;
+    }
+    patch_chain(p->chunk, ends, p->chunk->n);
+    return 0;
+}
+
+static int parse_while(parser_t *p) {
+    static const char *const cond_end[] = { "do", NULL };
+    static const char *const body_end[] = { "done", NULL };
+    int until = at_word(p, "until");
+    int slot = p->nloops - p->loop_base;
+
+    // The loop's status is the last body command's, 0 if the body never ran
+    p->pos++;
+    emit(p->chunk, OP_STATUS, 0, 0, NULL);
+    emit(p->chunk, OP_SAVE, slot, 0, NULL);
+    int top = p->chunk->n;
+    if (parse_list(p, cond_end) != 0 || expect(p, "do") != 0) {
+        return -1;
+    }
+    int exit_jump = emit(p->chunk, until ? OP_JUMP_TRUE : OP_JUMP_FALSE, -1, 0, NULL);
+    if (push_loop(p, 0, top) != 0) {
+        return -1;
+    }
+    if (parse_list(p, body_end) != 0 || expect(p, "done") != 0) {
+        return -1;
+    }
+    emit(p->chunk, OP_SAVE, slot, 0, NULL);
+    emit(p->chunk, OP_JUMP, top, 0, NULL);
+    patch_chain(p->chunk, exit_jump, p->chunk->n);
+    emit(p->chunk, OP_RESTORE, slot, 0, NULL);
+    pop_loop(p);
+    return 0;
+}
+
+static int parse_for(parser_t *p) {
+    static const char *const body_end[] = { "done", NULL };
+    tok_t *name;
+    cmd_t *list;
+
+    p->pos++;
+    name = peek(p);
+    if (name->type != T_WORD || !is_name(name->text, strlen(name->text))) {
+        return fail(p, "expected a variable name");
+    }
+    int slot = var_slot(name->text, strlen(name->text));
+    p->pos++;
+    if (!at_word(p, "in")) {
+        return fail(p, "expected 'in'");
+    }
+    p->pos++;
+
+    list = xrealloc(NULL, sizeof(cmd_t));
+    memset(list, 0, sizeof(*list));
+    while (peek(p)->type == T_WORD) {
+        list->words = xrealloc(list->words, (list->argc + 1) * sizeof(word_t));
+        if (compile_word(p, peek(p), &list->words[list->argc]) != 0) {
+            cmd_free(list);
+            return -1;
+        }
+        list->argc++;
+        p->pos++;
+    }
+    if (expect(p, "do") != 0) {
+        cmd_free(list);
+        return -1;
+    }
+
+    int depth = p->for_depth;
+    // An empty list leaves status 0, otherwise the last body command's status stays
+    emit(p->chunk, OP_STATUS, 0, 0, NULL);
+    emit(p->chunk, OP_FOR_INIT, depth, 0, list);
+    int next = emit(p->chunk, OP_FOR_NEXT, depth, slot, NULL);
+    if (push_loop(p, 1, next) != 0) {
+        return -1;
+    }
+    if (parse_list(p, body_end) != 0 || expect(p, "done") != 0) {
+        return -1;
+    }
+    emit(p->chunk, OP_JUMP, next, 0, NULL);
+    pop_loop(p);
+    p->chunk->code[next].c = p->chunk->n;
+    return 0;
+}
+
+static int parse_loop_jump(parser_t *p) {
+    int is_break = at_word(p, "break");
+
+    p->pos++;
+    if (!at_end_of_command(p)) {
+        return fail(p, "too many arguments");
+    }
+    if (p->nloops == p->loop_base) {
+        return fail(p, is_break ? "'break' outside a loop" : "'continue' outside a loop");
+    }
+    loop_t *l = &p->loops[p->nloops - 1];
+    if (!is_break) {
+        emit(p->chunk, OP_JUMP, l->continue_at, 0, NULL);
+        return 0;
+    }
+    emit(p->chunk, OP_STATUS, 0, 0, NULL);
+    if (l->is_for) {
+        emit(p->chunk, OP_FOR_POP, l->depth, 0, NULL);
+    }
+    l->breaks = emit(p->chunk, OP_JUMP, l->breaks, 0, NULL);
+    return 0;
+}
+
+static int parse_return(parser_t *p) {
+    word_t *w = NULL;
+
+    p->pos++;
+    if (!p->in_function) {
+        return fail(p, "'return' outside a function");
+    }
+    if (!at_end_of_command(p)) {
+        w = xrealloc(NULL, sizeof(word_t));
+        if (compile_word(p, peek(p), w) != 0) {
+            free(w);
+            return -1;
+        }
+        p->pos++;
+        if (!at_end_of_command(p)) {
+            word_clear(w);
+            free(w);
+            return fail(p, "too many arguments");
+        }
+    }
+    emit(p->chunk, OP_RETURN, 0, 0, w);
+    return 0;
+}
+
+/**
+ * @description Compile "name() { ... }" hoặc "function name { ... }" thành một chunk riêng.
+ * Chunk được đăng ký vào bảng hàm khi lệnh OP_DEFUN chạy.
+ */
+static int parse_function(parser_t *p) {
+    static const char *const body_end[] = { "}", NULL };
+    char name[SCRIPT_LINE_LENGTH];
+    tok_t *t = peek(p);
+
+    if (strcmp(t->text, "function") == 0) {
+        p->pos++;
+        t = peek(p);
+        if (t->type != T_WORD) {
+            return fail(p, "expected a function name");
+        }
+    }
+    snprintf(name, sizeof(name), "%s", t->text);
+    size_t len = strlen(name);
+    if (len > 2 && strcmp(name + len - 2, "()") == 0) {
+        name[len - 2] = '\0';
+    }
+    if (name[0] == '\0' || strchr(name, '/') != NULL || strchr(name, '$') != NULL || strchr(name, '=') != NULL) {
+        return fail(p, "bad function name");
+    }
+    p->pos++;
+    if (at_word(p, "()")) {
+        p->pos++;
+    }
+    if (expect(p, "{") != 0) {
+        return -1;
+    }
+
+    chunk_t *outer = p->chunk;
+    int saved_base = p->loop_base, saved_depth = p->for_depth, saved_in_function = p->in_function;
+    p->chunk = chunk_new();
+    p->loop_base = p->nloops;
+    p->for_depth = 0;
+    p->in_function = 1;
+    int rc = parse_list(p, body_end);
+    if (rc == 0) {
+        rc = expect(p, "}");
+    }
+    chunk_t *body = p->chunk;
+    p->chunk = outer;
+    p->loop_base = saved_base;
+    p->for_depth = saved_depth;
+    p->in_function = saved_in_function;
+    if (rc != 0) {
+        chunk_release(body);
+        return -1;
+    }
+
+    defun_t *d = xrealloc(NULL, sizeof(defun_t));
+    d->name = xstrdup(name);
+    d->body = body;
+    emit(p->chunk, OP_DEFUN, 0, 0, d);
+    return 0;
+}
+
+static int parse_command(parser_t *p) {
+    tok_t *t = peek(p);
+    size_t len = strlen(t->text);
+
+    if (in_list(t->text, reserved_words)) {
+        return fail(p, "syntax error");
+    }
+    if (strcmp(t->text, "if") == 0) {
+        return parse_if(p);
+    }
+    if (strcmp(t->text, "while") == 0 || strcmp(t->text, "until") == 0) {
+        return parse_while(p);
+    }
+    if (strcmp(t->text, "for") == 0) {
+        return parse_for(p);
+    }
+    if (strcmp(t->text, "break") == 0 || strcmp(t->text, "continue") == 0) {
+        return parse_loop_jump(p);
+    }
+    if (strcmp(t->text, "return") == 0) {
+        return parse_return(p);
+    }
+    if (strcmp(t->text, "function") == 0 || (len > 2 && strcmp(t->text + len - 2, "()") == 0) ||
+        (p->toks[p->pos + 1].type == T_WORD && strcmp(p->toks[p->pos + 1].text, "()") == 0)) {
+        return parse_function(p);
+    }
+    return parse_simple(p);
+}
+
+/**
+ * @description Compile các lệnh cho tới khi gặp một trong các từ khóa terms (không tiêu thụ nó)
+ * @param p parser, terms danh sách từ khóa kết thúc, NULL nghĩa là đọc tới hết input
+ * @return 0 nếu thành công, -1 nếu lỗi
+ */
+static int parse_list(parser_t *p, const char *const *terms) {
+    for (;;) {
+        skip_seps(p);
+        tok_t *t = peek(p);
+        if (t->type == T_EOF) {
+            return terms == NULL ? 0 : fail(p, "");
+        }
+        if (terms != NULL && in_list(t->text, terms)) {
+            return 0;
+        }
+        if (parse_command(p) != 0) {
+            return -1;
+        }
+    }
+}
+
+/**
+ * @description Compile source thành chunk
+ * @param src chuỗi nguồn, allow_return cho phép return ở top level (source), incomplete = 1 nếu
+ * input kết thúc giữa chừng một block, err bộ đệm thông báo lỗi
+ * @return chunk hoặc NULL nếu lỗi
+ */
+static chunk_t *compile(const char *src, int allow_return, int *incomplete, char *err, size_t err_size) {
+    parser_t p;
+    int count;
+
+    memset(&p, 0, sizeof(p));
+    p.toks = tokenize(src, &count);
+    p.chunk = chunk_new();
+    p.in_function = allow_return;
+    int rc = parse_list(&p, NULL);
+    tokens_free(p.toks, count);
+
+    *incomplete = p.incomplete;
+    if (rc != 0) {
+        snprintf(err, err_size, "%s", p.err);
+        chunk_release(p.chunk);
+        return NULL;
+    }
+    return p.chunk;
+}
+
+// ############################## EXECUTION #############################################
+
+static int expand_put(expansion_t *x, const char *s) {
+    size_t n = strlen(s);
+    // Always keep one byte for the terminating '\0'
+    if (x->len + n + 1 > sizeof(x->buf)) {
+        fprintf(stderr, "Error: Command too long after expansion.\n");
+        return -1;
+    }
+    memcpy(x->buf + x->len, s, n);
+    x->len += n;
+    return 0;
+}
+
+static int expand_add_arg(expansion_t *x, char *arg) {
+    if (x->argc == SCRIPT_MAX_ARGS) {
+        fprintf(stderr, "Error: Too many arguments.\n");
+        return -1;
+    }
+    x->argv[x->argc++] = arg;
+    x->argv[x->argc] = NULL;
+    return 0;
+}
+
+/**
+ * @description Mở rộng một word template. Word literal và $@ không phải copy chuỗi.
+ * @param x bộ đệm kết quả, w word, f positional parameters
+ * @return 0 nếu thành công, -1 nếu lỗi
+ */
+static int expand_word(expansion_t *x, const word_t *w, const frame_t *f) {
+    char num[32];
+    size_t start = x->len;
+    int has_literal = 0;
+
+    if (w->literal != NULL) {
+        return expand_add_arg(x, w->literal);
+    }
+    if (w->splat) {
+        for (int i = 1; i < f->argc; i++) {
+            if (expand_add_arg(x, f->argv[i]) != 0) {
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    for (int i = 0; i < w->nparts; i++) {
+        const part_t *part = &w->parts[i];
+        const char *s = num;
+        long val;
+        switch (part->kind) {
+        case PART_LIT:
+            s = part->text;
+            has_literal = 1;
+            break;
+        case PART_VAR:
+            s = var_get(part->n);
+            break;
+        case PART_POS:
+            s = part->n < f->argc ? f->argv[part->n] : "";
+            break;
+        case PART_STATUS:
+            snprintf(num, sizeof(num), "%d", last_status);
+            break;
+        case PART_ARGC:
+            snprintf(num, sizeof(num), "%d", f->argc > 0 ? f->argc - 1 : 0);
+            break;
+        case PART_ALL:
+            for (int j = 1; j < f->argc; j++) {
+                if ((j > 1 && expand_put(x, " ") != 0) || expand_put(x, f->argv[j]) != 0) {
+                    return -1;
+                }
+            }
+            continue;
+        case PART_ARITH:
+            if (arith_eval(part->expr, f, &val) != 0) {
+                return -1;
+            }
+            snprintf(num, sizeof(num), "%ld", val);
+            break;
+        }
+        if (expand_put(x, s) != 0) {
+            return -1;
+        }
+    }
+
+    // Like an unquoted $x in sh, a word that expands to nothing disappears
+    if (x->len == start && !has_literal) {
+        return 0;
+    }
+    x->buf[x->len++] = '\0';
+    return expand_add_arg(x, x->buf + start);
+}
+
+static int expand_words(expansion_t *x, const cmd_t *cmd, const frame_t *f) {
+    x->len = 0;
+    x->argc = 0;
+    x->argv[0] = NULL;
+    for (int i = 0; i < cmd->argc; i++) {
+        if (expand_word(x, &cmd->words[i], f) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int spawn(const char *path, char **argv) {
+    int status;
+    pid_t pid = fork();
+
+    if (pid == 0) {
+        if (path != NULL) {
+            execv(path, argv);
+        } else {
+            execvp(argv[0], argv);
+        }
+        fprintf(stderr, "Error: Failed to execute command.\n");
+        _exit(127);
+    } else if (pid < 0) {
+        perror("Error: Error forking");
+        return 1;
+    }
+    while (waitpid(pid, &status, WUNTRACED) == -1) {
+        if (errno != EINTR) {
+            return 1;
+        }
+    }
+    return wait_status(status);
+}
+
+/**
+ * @description Builtin test / [ chạy ngay trong shell, không fork
+ * @param argc số arg, argv mảng arg
+ * @return 0 nếu đúng, 1 nếu sai, 2 nếu sai cú pháp
+ */
+static int builtin_test(int argc, char **argv) {
+    static const char *const num_ops[] = { "-eq", "-ne", "-lt", "-le", "-gt", "-ge", NULL };
+    struct stat st;
+    int negate = 0, result;
+
+    if (strcmp(argv[0], "[") == 0) {
+        if (strcmp(argv[argc - 1], "]") != 0) {
+            fprintf(stderr, "Error: Missing ']'.\n");
+            return 2;
+        }
+        argc--;
+    }
+    argv++;
+    argc--;
+    if (argc > 0 && strcmp(argv[0], "!") == 0) {
+        negate = 1;
+        argv++;
+        argc--;
+    }
+
+    if (argc == 0) {
+        result = 1;
+    } else if (argc == 1) {
+        result = argv[0][0] == '\0';
+    } else if (argc == 2) {
+        const char *op = argv[0], *arg = argv[1];
+        if (strcmp(op, "-z") == 0) {
+            result = arg[0] != '\0';
+        } else if (strcmp(op, "-n") == 0) {
+            result = arg[0] == '\0';
+        } else if (strcmp(op, "-e") == 0) {
+            result = stat(arg, &st) != 0;
+        } else if (strcmp(op, "-f") == 0) {
+            result = !(stat(arg, &st) == 0 && S_ISREG(st.st_mode));
+        } else if (strcmp(op, "-d") == 0) {
+            result = !(stat(arg, &st) == 0 && S_ISDIR(st.st_mode));
+        } else if (strcmp(op, "-s") == 0) {
+            result = !(stat(arg, &st) == 0 && st.st_size > 0);
+        } else if (strcmp(op, "-r") == 0 || strcmp(op, "-w") == 0 || strcmp(op, "-x") == 0) {
+            int mode = op[1] == 'r' ? R_OK : (op[1] == 'w' ? W_OK : X_OK);
+            result = access(arg, mode) != 0;
+        } else {
+            fprintf(stderr, "Error: test: unknown operator %s\n", op);
+            return 2;
+        }
+    } else if (argc == 3) {
+        const char *a = argv[0], *op = argv[1], *b = argv[2];
+        if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0) {
+            result = strcmp(a, b) != 0;
+        } else if (strcmp(op, "!=") == 0) {
+            result = strcmp(a, b) == 0;
+        } else if (in_list(op, num_ops)) {
+            char *end_a, *end_b;
+            long x = strtol(a, &end_a, 10), y = strtol(b, &end_b, 10);
+            if (*a == '\0' || *end_a != '\0' || *b == '\0' || *end_b != '\0') {
+                fprintf(stderr, "Error: test: integer expression expected\n");
+                return 2;
+            }
+            if (strcmp(op, "-eq") == 0) {
+                result = !(x == y);
+            } else if (strcmp(op, "-ne") == 0) {
+                result = !(x != y);
+            } else if (strcmp(op, "-lt") == 0) {
+                result = !(x < y);
+            } else if (strcmp(op, "-le") == 0) {
+                result = !(x <= y);
+            } else if (strcmp(op, "-gt") == 0) {
+                result = !(x > y);
+            } else {
+                result = !(x >= y);
+            }
+        } else {
+            fprintf(stderr, "Error: test: unknown operator %s\n", op);
+            return 2;
+        }
+    } else {
+        fprintf(stderr, "Error: test: too many arguments\n");
+        return 2;
+    }
+    return negate ? !result : result;
+}
+
+static int call_chunk(chunk_t *c, int argc, char **argv) {
+    frame_t f = { argc, argv };
+    int status;
+
+    if (call_depth >= SCRIPT_MAX_CALL_DEPTH) {
+        fprintf(stderr, "Error: Maximum function nesting level exceeded.\n");
+        return 1;
+    }
+    // Keep the body alive even if it redefines itself while running
+    c->refs++;
+    call_depth++;
+    status = vm_run(c, &f);
+    call_depth--;
+    chunk_release(c);
+    return status;
+}
+
+/**
+ * @description Chạy một lệnh đã compile: hàm người dùng, builtin của script, builtin/redirect/pipe
+ * của shell (qua shell_exec) hoặc chương trình ngoài với đường dẫn đã resolve sẵn.
+ * @param cmd lệnh, f positional parameters
+ * @return exit status
+ */
+static int run_cmd(cmd_t *cmd, const frame_t *f) {
+    expansion_t x;
+    int kind = cmd->kind, fn = -1;
+
+    if (expand_words(&x, cmd, f) != 0) {
+        return 1;
+    }
+    if (x.argc == 0) {
+        return 0;
+    }
+
+    if (kind == CMD_DYNAMIC) {
+        fn = func_find(x.argv[0]);
+        kind = classify(x.argv[0]);
+    } else if (!cmd->redirect && cmd->wait && nfuncs > 0) {
+        if (cmd->fn_gen != fn_gen) {
+            cmd->fn_index = func_find(x.argv[0]);
+            cmd->fn_gen = fn_gen;
+        }
+        fn = cmd->fn_index;
+    }
+    if (fn >= 0) {
+        return call_chunk(funcs[fn].body, x.argc, x.argv);
+    }
+
+    switch (kind) {
+    case CMD_TEST:
+        return builtin_test(x.argc, x.argv);
+    case CMD_TRUE:
+        return 0;
+    case CMD_FALSE:
+        return 1;
+    case CMD_SOURCE:
+        return builtin_source(x.argc, x.argv);
+    case CMD_SHELL:
+        return shell_exec(x.argv, cmd->wait);
+    default:
+        return spawn(cmd->kind == CMD_EXTERNAL ? cmd->path : NULL, x.argv);
+    }
+}
+
+static void run_assign(const instr_t *in, const frame_t *f) {
+    expansion_t x;
+
+    x.len = 0;
+    x.argc = 0;
+    if (expand_word(&x, in->p, f) != 0) {
+        return;
+    }
+    var_set(in->a, x.argc > 0 ? x.argv[0] : "");
+}
+
+static int run_return(const instr_t *in, const frame_t *f) {
+    expansion_t x;
+
+    if (in->p == NULL) {
+        return last_status;
+    }
+    x.len = 0;
+    x.argc = 0;
+    if (expand_word(&x, in->p, f) != 0 || x.argc == 0) {
+        return 1;
+    }
+    return atoi(x.argv[0]) & 0xff;
+}
+
+typedef struct {
+    char **items;
+    int n, i;
+} for_frame_t;
+
+// Expands the word list once; items point into one block, the chunk or the caller's frame
+static void for_init(for_frame_t *loop, const cmd_t *list, const frame_t *f) {
+    expansion_t x;
+
+    free(loop->items);
+    loop->items = NULL;
+    loop->n = 0;
+    loop->i = 0;
+    if (expand_words(&x, list, f) != 0 || x.argc == 0) {
+        return;
+    }
+    loop->items = xrealloc(NULL, x.argc * sizeof(char *) + x.len);
+    char *strings = (char *)(loop->items + x.argc);
+    memcpy(strings, x.buf, x.len);
+    for (int i = 0; i < x.argc; i++) {
+        if (x.argv[i] >= x.buf && x.argv[i] < x.buf + sizeof(x.buf)) {
+            loop->items[i] = strings + (x.argv[i] - x.buf);
+        } else {
+            loop->items[i] = x.argv[i];
+        }
+    }
+    loop->n = x.argc;
+}
+
+/**
+ * @description Vòng lặp thực thi chunk
+ * @param c chunk, f positional parameters
+ * @return exit status của lệnh cuối cùng
+ */
+static int vm_run(chunk_t *c, const frame_t *f) {
+    for_frame_t loops[SCRIPT_MAX_NESTING];
+    int saved[SCRIPT_MAX_NESTING];
+    int pc = 0;
+
+    memset(loops, 0, sizeof(loops));
+    while (pc < c->n) {
+        const instr_t *in = &c->code[pc++];
+        switch (in->op) {
+        case OP_CMD:
+            last_status = run_cmd(in->p, f);
+            break;
+        case OP_ASSIGN:
+            run_assign(in, f);
+            last_status = 0;
+            break;
+        case OP_JUMP:
+            pc = in->a;
+            break;
+        case OP_JUMP_FALSE:
+            if (last_status != 0) {
+                pc = in->a;
+            }
+            break;
+        case OP_JUMP_TRUE:
+            if (last_status == 0) {
+                pc = in->a;
+            }
+            break;
+        case OP_FOR_INIT:
+            for_init(&loops[in->a], in->p, f);
+            break;
+        case OP_FOR_NEXT: {
+            for_frame_t *loop = &loops[in->a];
+            if (loop->i < loop->n) {
+                var_set(in->b, loop->items[loop->i++]);
+            } else {
+                free(loop->items);
+                loop->items = NULL;
+                pc = in->c;
+            }
+            break;
+        }
+        case OP_FOR_POP:
+            free(loops[in->a].items);
+            loops[in->a].items = NULL;
+            break;
+        case OP_DEFUN: {
+            const defun_t *d = in->p;
+            func_define(d->name, d->body);
+            last_status = 0;
+            break;
+        }
+        case OP_RETURN:
+            last_status = run_return(in, f);
+            pc = c->n;
+            break;
+        case OP_STATUS:
+            last_status = in->a;
+            break;
+        case OP_SAVE:
+            saved[in->a] = last_status;
+            break;
+        case OP_RESTORE:
+            last_status = saved[in->a];
+            break;
+        }
+    }
+    for (int i = 0; i < SCRIPT_MAX_NESTING; i++) {
+        free(loops[i].items);
+    }
+    return last_status;
+}
+
+static char *read_file(const char *path) {
+    FILE *fp = fopen(path, "r");
+    char *text = NULL;
+    size_t len = 0, cap = 0, n;
+
+    if (fp == NULL) {
+        return NULL;
+    }
+    do {
+        if (cap - len < 4096) {
+            cap = cap ? cap * 2 : 8192;
+            text = xrealloc(text, cap);
+        }
+        n = fread(text + len, 1, cap - len - 1, fp);
+        len += n;
+    } while (n > 0);
+    text[len] = '\0';
+    fclose(fp);
+    return text;
+}
+
+/**
+ * @description Builtin source / . : compile cả file một lần rồi chạy, $1.. là các arg còn lại
+ * @param argc số arg, argv mảng arg
+ * @return exit status
+ */
+static int builtin_source(int argc, char **argv) {
+    char err[128];
+    int incomplete, status;
+
+    if (argc < 2) {
+        fprintf(stderr, "Error: Expected argument to \"%s\"\n", argv[0]);
+        return 2;
+    }
+    char *text = read_file(argv[1]);
+    if (text == NULL) {
+        perror("Error: Cannot read script");
+        return 1;
+    }
+    chunk_t *c = compile(text, 1, &incomplete, err, sizeof(err));
+    free(text);
+    if (c == NULL) {
+        fprintf(stderr, "Error: %s: %s\n", argv[1], err);
+        return 2;
+    }
+    status = call_chunk(c, argc - 1, argv + 1);
+    chunk_release(c);
+    return status;
+}
+
+// ############################## PUBLIC API ############################################
+
+/**
+ * @description Khởi tạo scripting layer
+ * @param exec_fn hàm chạy lệnh qua đường exec bình thường của shell, builtins danh sách builtin
+ * của shell (luôn đi qua exec_fn), num_builtins số builtin
+ * @return None
+ */
+void script_init(script_exec_fn exec_fn, char **builtins, int num_builtins) {
+    shell_exec = exec_fn;
+    shell_builtins = builtins;
+    shell_num_builtins = num_builtins;
+}
+
+/**
+ * @description Kiểm tra dòng lệnh có cần scripting layer không: block, định nghĩa/gọi hàm,
+ * gán biến, source hoặc có '$'
+ * @param line dòng lệnh
+ * @return 1 nếu có, 0 nếu không
+ */
+int script_wants_line(const char *line) {
+    static const char *const keywords[] = { "if", "while", "until", "for", "function", "source", ".", NULL };
+    char word[SCRIPT_LINE_LENGTH];
+
+    line += strspn(line, " \t");
+    size_t len = strcspn(line, " \t;");
+    if (len == 0 || len >= sizeof(word)) {
+        return 0;
+    }
+    memcpy(word, line, len);
+    word[len] = '\0';
+
+    if (in_list(word, keywords) || is_assignment(word) || strchr(line, '$') != NULL) {
+        return 1;
+    }
+    if ((len > 2 && strcmp(word + len - 2, "()") == 0) || strncmp(line + len + strspn(line + len, " \t"), "()", 2) == 0) {
+        return 1;
+    }
+    return func_find(word) >= 0;
+}
+
+/**
+ * @description Chạy lệnh đã tách arg nếu nó thuộc scripting layer: hàm người dùng, source / .,
+ * test / [, true / : hoặc false
+ * @param argv mảng arg (argv[0] là tên lệnh), status nhận exit status nếu đã chạy
+ * @return 1 nếu đã chạy, 0 nếu không phải lệnh của scripting layer
+ */
+int script_call(char **argv, int *status) {
+    int argc = 0;
+    int fn = func_find(argv[0]);
+
+    while (argv[argc] != NULL) {
+        argc++;
+    }
+    if (fn >= 0) {
+        *status = call_chunk(funcs[fn].body, argc, argv);
+    } else {
+        switch (classify(argv[0])) {
+        case CMD_TEST:
+            *status = builtin_test(argc, argv);
+            break;
+        case CMD_TRUE:
+            *status = 0;
+            break;
+        case CMD_FALSE:
+            *status = 1;
+            break;
+        case CMD_SOURCE:
+            *status = builtin_source(argc, argv);
+            break;
+        default:
+            return 0;
+        }
+    }
+    last_status = *status;
+    return 1;
+}
+
+/**
+ * @description Compile và chạy một dòng lệnh. Nếu dòng mở một block chưa đóng thì đọc thêm
+ * dòng từ more (in prompt "> ") cho tới khi block hoàn chỉnh.
+ * @param line dòng đầu tiên, more nguồn đọc các dòng tiếp theo, NULL nếu không có,
+ * source nếu khác NULL nhận toàn bộ source đã đọc (chỉ dòng đầu nếu không đủ chỗ), source_size kích thước
+ * @return exit status
+ */
+int script_eval(const char *line, FILE *more, char *source, size_t source_size) {
+    char next[SCRIPT_LINE_LENGTH];
+    char err[128];
+    int incomplete;
+    char *text = xstrdup(line);
+    chunk_t *c;
+
+    while ((c = compile(text, 0, &incomplete, err, sizeof(err))) == NULL) {
+        if (!incomplete || more == NULL) {
+            break;
+        }
+        printf("> ");
+        fflush(stdout);
+        if (fgets(next, sizeof(next), more) == NULL) {
+            break;
+        }
+        next[strcspn(next, "\n")] = '\0';
+        size_t len = strlen(text);
+        text = xrealloc(text, len + strlen(next) + 2);
+        text[len] = '\n';
+        strcpy(text + len + 1, next);
+    }
+    if (source != NULL && source_size > 0 &&
+        (size_t)snprintf(source, source_size, "%s", text) >= source_size) {
+        snprintf(source, source_size, "%s", line);
+    }
+    free(text);
+    if (c == NULL) {
+        fprintf(stderr, "Error: %s\n", err);
+        last_status = 2;
+        return last_status;
+    }
+
+    int status = vm_run(c, &top_frame);
+    chunk_release(c);
+    return status;
+}
+
+/**
+ * @description Cập nhật $? sau lệnh chạy ngoài scripting layer
+ * @param status exit status
+ * @return None
+ */
+void script_set_status(int status) {
+    last_status = status;
+}
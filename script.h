@@ -0,0 +1,23 @@
+// script.h
+
+#ifndef SCRIPT_H
+#define SCRIPT_H
+
+#include <stdio.h>
+
+#define SCRIPT_MAX_ARGS 64          // same limit as BUFFER_SIZE in main.c
+#define SCRIPT_EXPAND_SIZE 4096     // bytes available to expand one command
+#define SCRIPT_MAX_NESTING 16       // nested loops inside one function body
+#define SCRIPT_MAX_CALL_DEPTH 256   // nested function calls and source
+
+// Runs a command through the shell's normal exec path and returns its exit status
+typedef int (*script_exec_fn)(char **argv, int wait);
+
+// Function prototypes
+void script_init(script_exec_fn exec_fn, char **builtins, int num_builtins);
+int script_wants_line(const char *line);
+int script_eval(const char *line, FILE *more, char *source, size_t source_size);
+int script_call(char **argv, int *status);
+void script_set_status(int status);
+
+#endif